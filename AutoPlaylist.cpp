@@ -45,13 +45,8 @@ void AutoPlaylist::readPlaylist(const string &filename)
     return;
   }
 
-  // re for filename match
-  CRegExp fnameext_match("\\.(3g2|3gp|amv|asf|avi|drc|f4a|f4b|f4p|f4v|flv|"
-    "m2ts|m2v|m4p|m4v|mkv|mov|mp2|mp4|mpe|mpeg|mpg|mpv|mts|mxf|nsv|ogg|"
-    "ogv|qt|rm|rmvb|roq|svi|ts|vob|webm|wmv|yuv|iso|dmg)$");
-
-  // Quit if file being played doesn't have one of the above filename extensions
-  if(fnameext_match.RegFind(basename) == -1) {
+  // Quit if file being played doesn't have one of the recognised filename extensions
+  if(!IsMediaFile(basename)) {
     puts("Disabling playlist as filename extension not recognised");
     return;
   }
@@ -59,7 +54,7 @@ void AutoPlaylist::readPlaylist(const string &filename)
   struct dirent *ent;
   while ((ent = readdir(dir))) {
     if(ent->d_type != DT_DIR && ent->d_name[0] != '.' &&
-        fnameext_match.RegFind(ent->d_name) > -1) {
+        IsMediaFile(ent->d_name)) {
 
       playlist.push_back(ent->d_name);
     }
@@ -84,6 +79,16 @@ void AutoPlaylist::readPlaylist(const string &filename)
   playlist.clear();
 }
 
+bool AutoPlaylist::IsMediaFile(const string &filename)
+{
+  // re for filename match
+  static thread_local CRegExp fnameext_match("\\.(3g2|3gp|amv|asf|avi|drc|f4a|f4b|f4p|f4v|flv|"
+    "m2ts|m2v|m4p|m4v|mkv|mov|mp2|mp4|mpe|mpeg|mpg|mpv|mts|mxf|nsv|ogg|"
+    "ogv|qt|rm|rmvb|roq|svi|ts|vob|webm|wmv|yuv|iso|dmg)$");
+
+  return fnameext_match.RegFind(filename) > -1;
+}
+
 bool AutoPlaylist::ChangeFile(int delta, string &filename)
 {
   int npos = playlist_pos + delta;
@@ -97,3 +102,16 @@ bool AutoPlaylist::ChangeFile(int delta, string &filename)
   filename = dirname + playlist[playlist_pos];
   return true;
 }
+
+// like ChangeFile but doesn't move the playlist position
+bool AutoPlaylist::PeekFile(int delta, string &filename) const
+{
+  int npos = playlist_pos + delta;
+  int last_index = playlist.size() - 1;
+
+  if(npos < 0 || npos > last_index)
+    return false;
+
+  filename = dirname + playlist[npos];
+  return true;
+}
@@ -26,6 +26,8 @@ class AutoPlaylist
 public:
   void readPlaylist(const std::string &indexfilepath);
   bool ChangeFile(int delta, std::string &filename);
+  bool PeekFile(int delta, std::string &filename) const;
+  static bool IsMediaFile(const std::string &filename);
 
 private:
   std::vector<std::string> playlist;
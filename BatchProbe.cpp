@@ -0,0 +1,153 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <algorithm>
+
+#include "BatchProbe.h"
+#include "AutoPlaylist.h"
+#include "OMXReaderFile.h"
+#include "OMXThread.h"
+#include "utils/misc.h"
+
+// probing is mostly waiting on the disk, so more threads than cores helps
+// up to a point
+#define MAX_PROBE_THREADS 16
+
+namespace {
+
+class ProbeWorker : public OMXThread
+{
+public:
+  ProbeWorker(const std::vector<std::string> &files, std::atomic<size_t> &next,
+      std::mutex &output_lock, std::atomic<int> &failed)
+  :
+  m_files(files),
+  m_next(next),
+  m_output_lock(output_lock),
+  m_failed(failed)
+  {
+    Create(THREAD_BACKGROUND, "probe");
+  }
+
+  // waits for the queue to empty
+  ~ProbeWorker() override
+  {
+    StopThread();
+  }
+
+private:
+  void Process() override
+  {
+    size_t i;
+    while((i = m_next++) < m_files.size())
+    {
+      std::string filename = m_files[i];
+      std::string line;
+
+      try
+      {
+        OMXReaderFile reader(filename, false, false);
+        reader.json_dump(m_files[i], line);
+      }
+      catch(const char *msg)
+      {
+        line = "{\"file\":\"" + json_escape(m_files[i]) + "\",\"error\":\"" + json_escape(msg) + "\"}";
+        m_failed++;
+      }
+
+      line.push_back('\n');
+
+      std::lock_guard<std::mutex> lock(m_output_lock);
+      fwrite(line.data(), 1, line.size(), stdout);
+      fflush(stdout);
+    }
+  }
+
+  const std::vector<std::string> &m_files;
+  std::atomic<size_t>       &m_next;
+  std::mutex                &m_output_lock;
+  std::atomic<int>          &m_failed;
+};
+
+void add_path(const std::string &path, std::vector<std::string> &files)
+{
+  struct stat st;
+  if(IsURL(path) || stat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+  {
+    files.push_back(path);
+    return;
+  }
+
+  DIR *dir = opendir(path.c_str());
+  if(!dir)
+    return;
+
+  std::string dirname = path;
+  if(dirname.back() != '/')
+    dirname.push_back('/');
+
+  std::vector<std::string> entries;
+  struct dirent *ent;
+  while((ent = readdir(dir)))
+  {
+    if(ent->d_type != DT_DIR && ent->d_name[0] != '.' && AutoPlaylist::IsMediaFile(ent->d_name))
+      entries.push_back(dirname + ent->d_name);
+  }
+  closedir(dir);
+
+  std::sort(entries.begin(), entries.end());
+  files.insert(files.end(), entries.begin(), entries.end());
+}
+
+} // namespace
+
+int BatchProbe::Run(const std::vector<std::string> &paths, int threads)
+{
+  std::vector<std::string> files;
+  for(const std::string &path : paths)
+    add_path(path, files);
+
+  // e.g. a directory with no media files in it
+  if(files.empty())
+    return EXIT_SUCCESS;
+
+  if(threads <= 0)
+    threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+  threads = std::clamp(threads, 1, std::min((int)files.size(), MAX_PROBE_THREADS));
+
+  std::atomic<size_t> next{0};
+  std::atomic<int> failed{0};
+  std::mutex output_lock;
+
+  {
+    std::vector<std::unique_ptr<ProbeWorker>> workers;
+    for(int i = 0; i < threads; i++)
+      workers.emplace_back(new ProbeWorker(files, next, output_lock, failed));
+  }
+
+  return failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,31 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string>
+#include <vector>
+
+// Opens a list of files and directories (whose media files are included)
+// on a pool of threads and prints one line of JSON per file describing its
+// streams. Results are saved in the probe cache as they go.
+class BatchProbe
+{
+public:
+  static int Run(const std::vector<std::string> &paths, int threads);
+};
@@ -0,0 +1,228 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include <libavutil/avutil.h>
+}
+
+#include "BufferPolicy.h"
+#include "OMXClock.h"
+#include "utils/misc.h"
+#include "utils/log.h"
+
+// never ask for more than this much to be buffered [s]
+#define MAX_THRESHOLD       16.0f
+// running dry this soon after the last time means the threshold is well
+// short, so it's doubled rather than raised by half [us]
+#define QUICK_REBUFFER      30000000
+// aim for no more than this chance of running dry within HOLD_TIME of
+// resuming, and while the input is slower than the media buffer enough to
+// play for that long [s]
+#define TARGET_REBUFFER     0.05f
+#define HOLD_TIME           60.0f
+// playing time assumed before a source is first used, so that one early
+// underrun doesn't look like a very unreliable source [s]
+#define PRIOR_TIME          300.0f
+// underruns remembered per source
+#define MAX_HISTORY         16
+// how long playback must go without running dry before the threshold is
+// lowered, and by at most how much. The underruns of a source which isn't
+// being used fade by the same amount every period. [us]
+#define STABLE_TIME         60000000
+#define DECAY               0.75f
+// the input rate is measured over this long [us] and smoothed
+#define RATE_INTERVAL       500000
+#define RATE_SMOOTHING      0.2f
+
+// the server for network streams, otherwise the directory
+static std::string source_key(const std::string &filename)
+{
+  if(IsPipe(filename))
+    return "pipe:";
+
+  size_t pos;
+  if(IsURL(filename) && (pos = filename.find("://")) != std::string::npos)
+    return filename.substr(0, filename.find('/', pos + 3));
+
+  pos = filename.rfind('/');
+  return pos == std::string::npos ? "." : filename.substr(0, pos);
+}
+
+void BufferPolicy::Open(const std::string &filename, float base)
+{
+  int64_t now = OMXClock::GetAbsoluteClock();
+
+  m_key = source_key(filename);
+  m_base = base;
+  m_underruns = 0;
+  m_resumed_at = 0;
+  m_dry_at = 0;
+  m_stable_time = 0;
+  m_last_update = 0;
+  m_rate_valid = false;
+  Flush();
+
+  m_source = &m_sources[m_key];
+  if(m_source->last_seen)
+  {
+    // forget a little of what was learnt for every stable period since
+    float periods = std::max((float)(now - m_source->last_seen) / STABLE_TIME, 0.0f);
+    m_source->underruns *= powf(DECAY, periods);
+  }
+  m_source->last_seen = now;
+
+  m_threshold = Choose();
+  if(m_threshold > m_base)
+  {
+    CLogLog(LOGINFO, "BufferPolicy: %s threshold %.2fs, %.1f underruns in %.0fs", m_key.c_str(),
+        m_threshold, m_source->underruns, m_source->play_time);
+  }
+}
+
+// Underruns are taken to come at random, at the rate this source has had
+// them, and to need a buffer like the ones they needed before. This is the
+// smallest threshold for which the chance of running dry within HOLD_TIME of
+// resuming is under TARGET_REBUFFER.
+float BufferPolicy::Choose()
+{
+  const Source &s = *m_source;
+  if(s.needed.empty())
+    return m_base;
+
+  // underruns expected while playing for HOLD_TIME
+  float expected = s.underruns / (s.play_time + PRIOR_TIME) * HOLD_TIME;
+
+  // the share of them that the threshold can afford to fall short of
+  float allowed = expected > 0.0f ? -logf(1.0f - TARGET_REBUFFER) / expected : 1.0f;
+  if(allowed >= 1.0f)
+    return m_base;
+
+  std::vector<float> needed(s.needed);
+  std::sort(needed.begin(), needed.end());
+  size_t short_of = (size_t)(allowed * needed.size());
+
+  return std::min(std::max(needed[needed.size() - 1 - short_of], m_base), MAX_THRESHOLD);
+}
+
+void BufferPolicy::Flush()
+{
+  m_last_time = 0;
+}
+
+void BufferPolicy::SetThreshold(float threshold, const char *why)
+{
+  threshold = std::min(std::max(threshold, m_base), MAX_THRESHOLD);
+
+  CLogLog(LOGINFO, "BufferPolicy: %s, input %.2fx, threshold %.2fs -> %.2fs", why,
+      GetInputRate(), m_threshold, threshold);
+
+  m_threshold = threshold;
+  m_stable_time = 0;
+}
+
+void BufferPolicy::Update(int64_t now, int64_t buffered_end, bool playing)
+{
+  if(buffered_end == AV_NOPTS_VALUE)
+  {
+    m_last_time = 0;
+  }
+  else if(m_last_time == 0)
+  {
+    m_last_end = buffered_end;
+    m_last_time = now;
+  }
+  else if(now - m_last_time >= RATE_INTERVAL)
+  {
+    float rate = (float)(buffered_end - m_last_end) / (now - m_last_time);
+    m_rate = m_rate_valid ? m_rate + (rate - m_rate) * RATE_SMOOTHING : rate;
+    m_rate_valid = true;
+    m_last_end = buffered_end;
+    m_last_time = now;
+  }
+
+  if(playing && m_last_update)
+  {
+    m_stable_time += now - m_last_update;
+    m_source->play_time += (now - m_last_update) * 1e-6f;
+  }
+  m_last_update = now;
+  m_source->last_seen = now;
+
+  // lower the threshold again once the input is keeping up and the history
+  // says it can come down
+  if(m_threshold > m_base && m_stable_time > STABLE_TIME && (!m_rate_valid || m_rate >= 1.0f))
+  {
+    float threshold = std::max(Choose(), m_threshold * DECAY);
+    if(threshold < m_threshold)
+      SetThreshold(threshold, "stable");
+    else
+      m_stable_time = 0;
+  }
+}
+
+void BufferPolicy::Underrun(int64_t now)
+{
+  m_underruns++;
+  m_source->underruns += 1.0f;
+  m_dry_at = now;
+  m_dry_threshold = m_threshold;
+
+  // the threshold has just turned out to be short, whatever the history says
+  bool quick = m_resumed_at != 0 && now - m_resumed_at < QUICK_REBUFFER;
+  float threshold = std::max(Choose(), m_threshold * (quick ? 2.0f : 1.5f));
+
+  // enough to play for a while even if the input doesn't get any faster
+  if(m_rate_valid && m_rate < 1.0f)
+    threshold = std::max(threshold, HOLD_TIME * (1.0f - m_rate));
+
+  char why[64];
+  if(m_resumed_at != 0)
+    snprintf(why, sizeof(why), "ran dry after %.1fs", (now - m_resumed_at) * 1e-6);
+  else
+    snprintf(why, sizeof(why), "ran dry");
+
+  SetThreshold(threshold, why);
+}
+
+void BufferPolicy::Resumed(int64_t now)
+{
+  m_resumed_at = now;
+
+  if(!m_dry_at)
+    return;
+
+  // Playback stopped for this long while the threshold's worth arrived. Had
+  // there been the difference buffered on top of what there was, it
+  // wouldn't have stopped at all.
+  float stalled = (now - m_dry_at) * 1e-6f;
+  float needed = std::min(m_dry_threshold + std::max(stalled - m_threshold, 0.0f), MAX_THRESHOLD);
+  m_dry_at = 0;
+
+  std::vector<float> &history = m_source->needed;
+  history.push_back(needed);
+  if(history.size() > MAX_HISTORY)
+    history.erase(history.begin());
+
+  CLogLog(LOGINFO, "BufferPolicy: stalled for %.1fs, %.2fs would have been enough", stalled, needed);
+}
@@ -0,0 +1,82 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Decides how much has to be buffered before playback starts or resumes
+// after running dry.
+//
+// Each source (server, pipe or directory) has a history of how often it has
+// run dry per hour played, and of how much buffer each of those times would
+// have needed to keep going. The threshold is the smallest which that
+// history says has less than a 5% chance of running dry again within a
+// minute of resuming. As more is played without trouble the chance falls
+// and so does the threshold, back towards the --threshold.
+//
+// The rate at which media arrives is measured too (in seconds of media per
+// second), and while it's below 1 the threshold is kept high enough to play
+// for a while at that rate.
+class BufferPolicy
+{
+public:
+  void Open(const std::string &filename, float base);
+  void Flush();
+
+  // buffered_end is the media time of the newest data received, or
+  // AV_NOPTS_VALUE when the input rate can't be measured (eg eof or paused)
+  void Update(int64_t now, int64_t buffered_end, bool playing);
+  void Underrun(int64_t now);
+  void Resumed(int64_t now);
+
+  float GetThreshold() { return m_threshold; }
+  float GetInputRate() { return m_rate_valid ? m_rate : 0.0f; }
+  unsigned int GetUnderruns() { return m_underruns; }
+
+private:
+  struct Source
+  {
+    int64_t last_seen   = 0;
+    float   play_time   = 0.0f; // [s]
+    float   underruns   = 0.0f; // fades while the source isn't used
+    std::vector<float> needed;  // by the most recent underruns [s]
+  };
+
+  float Choose();
+  void SetThreshold(float threshold, const char *why);
+
+  std::unordered_map<std::string, Source> m_sources;
+  std::string   m_key;
+  Source        *m_source     = nullptr;
+  float         m_base        = 0.2f;
+  float         m_threshold   = 0.2f;
+  float         m_rate        = 0.0f;
+  bool          m_rate_valid  = false;
+  int64_t       m_last_end    = 0;
+  int64_t       m_last_time   = 0;
+  int64_t       m_resumed_at  = 0;
+  int64_t       m_dry_at      = 0;  // when playback last ran dry, until resumed
+  float         m_dry_threshold = 0.0f;
+  int64_t       m_stable_time = 0;  // spent playing since the last change
+  int64_t       m_last_update = 0;
+  unsigned int  m_underruns   = 0;
+};
@@ -23,6 +23,7 @@ extern "C" {
 
 #include "KeyConfig.h"
 #include "CECListener.h"
+#include "utils/EventLoop.h"
 
 CECListener::CECListener()
 {
@@ -86,13 +87,17 @@ void CECListener::ActionCallback(void *object, uint32_t response, uint32_t param
     listener->m_action = ACTION_PAUSE;
     break;
   case CEC_User_Control_Backward:
-  case CEC_User_Control_Rewind:
     listener->m_action = ACTION_SEEK_BACK_SMALL;
     break;
+  case CEC_User_Control_Rewind:
+    listener->m_action = ACTION_REWIND;
+    break;
   case CEC_User_Control_Forward:
-  case CEC_User_Control_FastForward:
     listener->m_action = ACTION_SEEK_FORWARD_SMALL;
     break;
+  case CEC_User_Control_FastForward:
+    listener->m_action = ACTION_FAST_FORWARD;
+    break;
   case CEC_User_Control_Subpicture:
   case CEC_User_Control_F2Red:
     listener->m_action = ACTION_NEXT_SUBTITLE;
@@ -100,6 +105,8 @@ void CECListener::ActionCallback(void *object, uint32_t response, uint32_t param
   default:
     return;
   }
+
+  EventLoop::Wake();
 }
 
 enum Action CECListener::getEvent()
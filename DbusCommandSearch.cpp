@@ -40,6 +40,7 @@ const struct lookup_item table[] = {
 {"CanRaise",            CAN_RAISE,                 GET_CAN_RAISE},
 {"CanSeek",             CAN_SEEK,                  CAN_SEEK},
 {"CanSetFullscreen",    CAN_SET_FULLSCREEN,        CAN_SET_FULLSCREEN},
+{"Chapter",             INVALID_METHOD,            GET_CHAPTER},
 {"Duration",            GET_DURATION,              GET_DURATION},
 {"Fullscreen",          CAN_GO_FULLSCREEN,         GET_FULLSCREEN},
 {"Get",                 GET,                       INVALID_PROPERTY},
@@ -48,6 +49,7 @@ const struct lookup_item table[] = {
 {"HideSubtitles",       ACTION_HIDE_SUBTITLES,     INVALID_PROPERTY},
 {"HideVideo",           ACTION_HIDE_VIDEO,         INVALID_PROPERTY},
 {"Identity",            GET_IDENTITY,              GET_IDENTITY},
+{"Latency",             INVALID_METHOD,            GET_LATENCY},
 {"ListAudio",           LIST_AUDIO,                INVALID_PROPERTY},
 {"ListChapters",        LIST_CHAPTERS,             INVALID_PROPERTY},
 {"ListSubtitles",       LIST_SUBTITLES,            INVALID_PROPERTY},
@@ -59,6 +61,7 @@ const struct lookup_item table[] = {
 {"Next",                ACTION_NEXT_CHAPTER,       INVALID_PROPERTY},
 {"OpenUri",             OPEN_URI,                  INVALID_PROPERTY},
 {"Pause",               ACTION_PAUSE,              INVALID_PROPERTY},
+{"PipeBuffer",          INVALID_METHOD,            GET_PIPE_BUFFER},
 {"Play",                ACTION_PLAY,               INVALID_PROPERTY},
 {"PlayPause",           ACTION_PLAYPAUSE,          INVALID_PROPERTY},
 {"PlaybackStatus",      GET_PLAYBACK_STATUS,       GET_PLAYBACK_STATUS},
@@ -83,6 +86,7 @@ const struct lookup_item table[] = {
 {"Stop",                ACTION_EXIT,               INVALID_PROPERTY},
 {"SupportedMimeTypes",  GET_SUPPORTED_MIME_TYPES,  GET_SUPPORTED_MIME_TYPES},
 {"SupportedUriSchemes", GET_SUPPORTED_URI_SCHEMES, GET_SUPPORTED_URI_SCHEMES},
+{"ThreadStats",         INVALID_METHOD,            GET_THREAD_STATS},
 {"UnHideVideo",         ACTION_UNHIDE_VIDEO,       INVALID_PROPERTY},
 {"Unmute",              ACTION_UNMUTE,             INVALID_PROPERTY},
 {"VideoPos",            SET_VIDEO_POS,             INVALID_PROPERTY},
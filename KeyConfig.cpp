@@ -42,6 +42,7 @@ const struct action_lookup table[] = {
   {"DECREASE_SUBTITLE_DELAY", ACTION_DECREASE_SUBTITLE_DELAY},
   {"DECREASE_VOLUME", ACTION_DECREASE_VOLUME},
   {"EXIT", ACTION_EXIT},
+  {"FAST_FORWARD", ACTION_FAST_FORWARD},
   {"HIDE_SUBTITLES", ACTION_HIDE_SUBTITLES},
   {"INCREASE_SPEED", ACTION_INCREASE_SPEED},
   {"INCREASE_SUBTITLE_DELAY", ACTION_INCREASE_SUBTITLE_DELAY},
@@ -55,6 +56,7 @@ const struct action_lookup table[] = {
   {"PREVIOUS_CHAPTER", ACTION_PREVIOUS_CHAPTER},
   {"PREVIOUS_FILE", ACTION_PREVIOUS_FILE},
   {"PREVIOUS_SUBTITLE", ACTION_PREVIOUS_SUBTITLE},
+  {"REWIND", ACTION_REWIND},
   {"SEEK_BACK_LARGE", ACTION_SEEK_BACK_LARGE},
   {"SEEK_BACK_SMALL", ACTION_SEEK_BACK_SMALL},
   {"SEEK_FORWARD_LARGE", ACTION_SEEK_FORWARD_LARGE},
@@ -112,8 +114,8 @@ static bool getActionAndKeyFromString(const string &line, int &int_action, strin
  */
 static void buildDefaultKeymap(unordered_map<int,int> &keymap)
 {
-  keymap['<'] = ACTION_DECREASE_SPEED;
-  keymap['>'] = ACTION_INCREASE_SPEED;
+  keymap['<'] = ACTION_REWIND;
+  keymap['>'] = ACTION_FAST_FORWARD;
   keymap[','] = ACTION_DECREASE_SPEED;
   keymap['.'] = ACTION_INCREASE_SPEED;
   keymap['j'] = ACTION_PREVIOUS_AUDIO;
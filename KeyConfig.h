@@ -28,8 +28,8 @@ enum Action
   // numbers should be maintained for compatibility purposes
   ACTION_DECREASE_SPEED = 1,
   ACTION_INCREASE_SPEED = 2,
-  //ACTION_REWIND = 3,
-  //ACTION_FAST_FORWARD = 4,
+  ACTION_REWIND = 3,
+  ACTION_FAST_FORWARD = 4,
   //ACTION_SHOW_INFO = 5,
   ACTION_PREVIOUS_AUDIO = 6,
   ACTION_NEXT_AUDIO = 7,
@@ -92,13 +92,16 @@ enum Action
   GET,
   GET_ASPECT,
   GET_CAN_RAISE,
+  GET_CHAPTER,
   GET_DURATION,
   GET_FULLSCREEN,
   GET_HAS_TRACK_LIST,
   GET_IDENTITY,
+  GET_LATENCY,
   GET_MAXIMUM_RATE,
   GET_METADATA,
   GET_MINIMUM_RATE,
+  GET_PIPE_BUFFER,
   GET_PLAYBACK_STATUS,
   GET_POSITION,
   GET_RATE,
@@ -107,6 +110,7 @@ enum Action
   GET_SOURCE,
   GET_SUPPORTED_MIME_TYPES,
   GET_SUPPORTED_URI_SCHEMES,
+  GET_THREAD_STATS,
   GET_VIDEO_STREAM_COUNT,
   GET_VOLUME,
   HAS_TRACK_LIST,
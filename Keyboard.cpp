@@ -23,10 +23,12 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 
 #include "utils/log.h"
 #include "Keyboard.h"
 #include "KeyConfig.h"
+#include "utils/EventLoop.h"
 
 Keyboard::Keyboard(const char *filename)
 {
@@ -54,7 +56,7 @@ Keyboard::Keyboard(const char *filename)
     fcntl(STDIN_FILENO, F_SETFL, orig_fl | O_NONBLOCK);
   }
 
-  Create();
+  Create(THREAD_INPUT, "keyboard");
 }
 
 Keyboard::~Keyboard()
@@ -87,11 +89,17 @@ void Keyboard::Sleep(unsigned int dwMilliSeconds)
 
 void Keyboard::Process()
 {
+  struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+
   while(!m_bAbort)
   {
     int ch[8];
     int chnum = 0;
 
+    // the timeout is only there so that m_bAbort gets noticed
+    if(poll(&pfd, 1, 100) <= 0)
+      continue;
+
     while ((ch[chnum] = getchar()) != EOF) chnum++;
 
     if(chnum > 0)
@@ -119,10 +127,16 @@ void Keyboard::Process()
 
       int action = m_keymap[result];
       if(action != 0)
+      {
         m_action = action;
+        EventLoop::Wake();
+      }
+    }
+    else
+    {
+      // stdin is at eof so poll won't block
+      Sleep(20);
     }
-
-    Sleep(20);
   }
 }
 
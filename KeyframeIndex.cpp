@@ -0,0 +1,212 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+#include "KeyframeIndex.h"
+#include "ProbeCache.h"
+#include "OMXClock.h"
+#include "utils/log.h"
+
+// keyframes closer together than this aren't worth remembering
+#define MIN_KEYFRAME_SPACING 500000
+
+// neighbouring entries further apart than this have a part of the file
+// between them which hasn't been indexed yet
+#define MAX_KEYFRAME_GAP (5 * AV_TIME_BASE)
+
+// otherwise don't trust an entry this far from where we're seeking to
+#define MAX_KEYFRAME_DISTANCE AV_TIME_BASE
+
+bool KeyframeIndex::s_background_scan = false;
+
+void KeyframeIndex::Add(int64_t pts, int64_t pos)
+{
+  if(pts == AV_NOPTS_VALUE || pos < 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  auto next = m_entries.lower_bound(pts);
+  if(next != m_entries.end() && next->first - pts < MIN_KEYFRAME_SPACING)
+    return;
+  if(next != m_entries.begin() && pts - std::prev(next)->first < MIN_KEYFRAME_SPACING)
+    return;
+
+  m_entries.emplace_hint(next, pts, pos);
+  m_dirty = true;
+}
+
+// Find the byte offset of the keyframe before pts, or after it if not
+// seeking backwards. Until a background scan has finished the index only
+// covers what has been played, so an entry is only used if the target lies
+// between it and a close neighbour, or if it's very near the target.
+// Otherwise av_seek_frame will do better.
+bool KeyframeIndex::Find(int64_t pts, bool backwards, int64_t &pos)
+{
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  auto next = m_entries.lower_bound(pts);
+  if(next != m_entries.end() && next->first == pts)
+  {
+    pos = next->second;
+    return true;
+  }
+
+  auto prev = next != m_entries.begin() ? std::prev(next) : m_entries.end();
+  bool between = prev != m_entries.end() && next != m_entries.end() &&
+      next->first - prev->first <= MAX_KEYFRAME_GAP;
+
+  auto it = backwards ? prev : next;
+  if(it == m_entries.end() || (!between && llabs(it->first - pts) > MAX_KEYFRAME_DISTANCE))
+    return false;
+
+  pos = it->second;
+  return true;
+}
+
+bool KeyframeIndex::Load(const std::string &filename)
+{
+  std::string path, key;
+  if(!ProbeCache::Locate(filename, "keys", path, key))
+    return false;
+
+  std::ifstream f(path, std::ios::binary);
+  if(!f)
+    return false;
+
+  std::string header(key.size(), '\0');
+  if(!f.read(&header[0], header.size()) || header != key)
+    return false;
+
+  std::lock_guard<std::mutex> lock(m_lock);
+
+  int64_t entry[2];
+  while(f.read((char *)entry, sizeof(entry)))
+    m_entries.emplace_hint(m_entries.end(), entry[0], entry[1]);
+
+  CLogLog(LOGDEBUG, "KeyframeIndex: loaded %zu entries for %s", m_entries.size(), filename.c_str());
+  return true;
+}
+
+void KeyframeIndex::Save(const std::string &filename)
+{
+  std::string path, key;
+  if(!ProbeCache::Locate(filename, "keys", path, key))
+    return;
+
+  std::lock_guard<std::mutex> lock(m_lock);
+  if(!m_dirty)
+    return;
+
+  std::string tmp = path + ".tmp";
+  std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+  f.write(key.data(), key.size());
+  for(const auto &e : m_entries)
+  {
+    int64_t entry[2] = { e.first, e.second };
+    f.write((const char *)entry, sizeof(entry));
+  }
+  f.close();
+
+  if(f)
+    rename(tmp.c_str(), path.c_str());
+  else
+    remove(tmp.c_str());
+
+  m_dirty = false;
+
+  ProbeCache::Prune();
+}
+
+KeyframeScanner::KeyframeScanner(const std::string &filename, KeyframeIndex *index)
+:
+m_filename(filename),
+m_index(index)
+{
+  Create(THREAD_BACKGROUND, "keyscan");
+}
+
+KeyframeScanner::~KeyframeScanner()
+{
+  if(ThreadHandle())
+    StopThread();
+}
+
+static int scanner_interrupt_cb(void *abort)
+{
+  return *static_cast<std::atomic<bool> *>(abort);
+}
+
+void KeyframeScanner::Process()
+{
+  AVFormatContext *fmt = avformat_alloc_context();
+  if(!fmt)
+    return;
+
+  fmt->interrupt_callback = { scanner_interrupt_cb, &m_bAbort };
+
+  if(avformat_open_input(&fmt, m_filename.c_str(), nullptr, nullptr) < 0)
+    return;
+
+  if(!ProbeCache::Load(m_filename, fmt) && avformat_find_stream_info(fmt, nullptr) < 0)
+  {
+    avformat_close_input(&fmt);
+    return;
+  }
+
+  // only the video stream matters
+  int video = av_find_best_stream(fmt, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  for(unsigned int i = 0; i < fmt->nb_streams; i++)
+    fmt->streams[i]->discard = (int)i == video ? AVDISCARD_NONKEY : AVDISCARD_ALL;
+
+  int64_t start_time = fmt->start_time != AV_NOPTS_VALUE ? fmt->start_time : 0;
+  AVPacket *pkt = av_packet_alloc();
+  unsigned int count = 0;
+
+  while(video >= 0 && pkt && !m_bAbort && av_read_frame(fmt, pkt) >= 0)
+  {
+    if(pkt->stream_index == video && (pkt->flags & AV_PKT_FLAG_KEY))
+    {
+      AVStream *st = fmt->streams[video];
+      int64_t ts = pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+      if(ts != AV_NOPTS_VALUE)
+        m_index->Add(av_rescale_q(ts, st->time_base, AV_TIME_BASE_Q) - start_time, pkt->pos);
+    }
+    av_packet_unref(pkt);
+
+    // stay out of the way of the demuxer which is actually playing
+    if((++count & 63) == 0)
+      OMXClock::Sleep(1);
+  }
+
+  CLogLog(LOGDEBUG, "KeyframeScanner: finished %s", m_filename.c_str());
+
+  av_packet_free(&pkt);
+  avformat_close_input(&fmt);
+}
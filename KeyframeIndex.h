@@ -0,0 +1,63 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <mutex>
+
+#include "OMXThread.h"
+
+// Maps the pts of video keyframes to their byte offsets, for containers
+// like MPEG-TS which have no index of their own and where av_seek_frame has
+// to bisect the file. Entries are added as packets are demuxed (and
+// optionally by a background scan) and the index is saved next to the
+// probe cache so it is there the next time the file is played.
+class KeyframeIndex
+{
+public:
+  void Add(int64_t pts, int64_t pos);
+  bool Find(int64_t pts, bool backwards, int64_t &pos);
+  bool Load(const std::string &filename);
+  void Save(const std::string &filename);
+
+  static void SetBackgroundScan(bool scan) { s_background_scan = scan; }
+  static bool BackgroundScan() { return s_background_scan; }
+
+private:
+  std::mutex                m_lock;
+  std::map<int64_t,int64_t> m_entries;
+  bool                      m_dirty = false;
+  static bool               s_background_scan;
+};
+
+// Reads through a file on its own demuxer filling in a KeyframeIndex
+class KeyframeScanner : public OMXThread
+{
+public:
+  KeyframeScanner(const std::string &filename, KeyframeIndex *index);
+  ~KeyframeScanner() override;
+
+private:
+  void Process() override;
+
+  std::string               m_filename;
+  KeyframeIndex             *m_index;
+};
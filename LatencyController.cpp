@@ -0,0 +1,98 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "LatencyController.h"
+#include "utils/log.h"
+
+// time constant of the smoothing applied to the measured latency
+#define SMOOTHING_TIME      2.0f
+// don't bother the clock with changes smaller than this...
+#define MIN_SPEED_STEP      0.0001f
+// ...or more often than this (us)
+#define MIN_SPEED_INTERVAL  250000
+
+// With the latency changing at the rate of the correction these give a
+// critically damped loop (kp^2 = 4 ki) which settles in a couple of minutes.
+float LatencyController::s_kp = 0.02f;
+float LatencyController::s_ki = 0.0001f;
+float LatencyController::s_max_correction = 0.01f;
+float LatencyController::s_max_slew = 0.002f;
+
+void LatencyController::SetParams(float kp, float ki, float max_correction, float max_slew)
+{
+  s_kp = std::max(kp, 0.0f);
+  s_ki = std::max(ki, 0.0f);
+  s_max_correction = std::min(std::max(max_correction, 0.0f), 0.5f);
+  s_max_slew = std::max(max_slew, 0.0f);
+}
+
+void LatencyController::Reset(float latency)
+{
+  m_latency = latency;
+  m_last_update = 0;
+}
+
+bool LatencyController::Update(float latency, int64_t now, float &speed)
+{
+  if(m_last_update == 0)
+  {
+    m_last_update = now;
+    return false;
+  }
+
+  float dt = std::min((now - m_last_update) * 1e-6f, 1.0f);
+  m_last_update = now;
+  if(dt <= 0.0f)
+    return false;
+
+  m_latency += (latency - m_latency) * dt / (SMOOTHING_TIME + dt);
+  float error = m_latency - m_target;
+
+  // don't let the integral wind up while the correction is pinned at the
+  // limit, unless it's on its way back
+  float proportional = s_kp * error;
+  float wanted = proportional + s_ki * (m_integral + error * dt);
+  if(fabsf(wanted) < s_max_correction || wanted * error < 0.0f)
+    m_integral += error * dt;
+
+  if(s_ki > 0.0f)
+  {
+    float limit = s_max_correction / s_ki;
+    m_integral = std::min(std::max(m_integral, -limit), limit);
+  }
+
+  wanted = proportional + s_ki * m_integral;
+  wanted = std::min(std::max(wanted, -s_max_correction), s_max_correction);
+
+  float step = s_max_slew * dt;
+  m_correction += std::min(std::max(wanted - m_correction, -step), step);
+
+  if(fabsf(m_correction - m_applied) < MIN_SPEED_STEP || now - m_last_applied < MIN_SPEED_INTERVAL)
+    return false;
+
+  m_applied = m_correction;
+  m_last_applied = now;
+  speed = 1.0f + m_correction;
+
+  CLogLog(LOGDEBUG, "Live: %.3f (%.3f) S:%.4f T:%.2f I:%.3f", m_latency, latency, speed, m_target, m_integral);
+  return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+
+// Keeps the latency of a live stream (how far playback is behind what has
+// been received) near a target by running the clock slightly fast or slow.
+//
+// The latency is smoothed and fed to a proportional-integral controller.
+// The integral term takes up any steady drift between the sender's clock
+// and ours. The correction is capped, and the rate at which it can change
+// is limited, so that the resampling it causes can't be heard.
+class LatencyController
+{
+public:
+  // start again from latency, keeping what has been learnt about drift
+  void Reset(float latency);
+
+  // returns true if the clock speed should be changed to speed
+  bool Update(float latency, int64_t now, float &speed);
+
+  void SetTarget(float target) { m_target = target; }
+  float GetTarget() { return m_target; }
+  float GetLatency() { return m_latency; }
+  float GetCorrection() { return m_correction; }
+
+  // gains, maximum correction and maximum change in correction per second
+  static void SetParams(float kp, float ki, float max_correction, float max_slew);
+
+private:
+  float   m_target = 0.0f;
+  float   m_latency = 0.0f;       // smoothed
+  float   m_integral = 0.0f;
+  float   m_correction = 0.0f;    // speed - 1
+  float   m_applied = 0.0f;       // correction last passed back to the caller
+  int64_t m_last_update = 0;
+  int64_t m_last_applied = 0;
+
+  static float s_kp;
+  static float s_ki;
+  static float s_max_correction;
+  static float s_max_slew;
+};
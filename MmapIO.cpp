@@ -0,0 +1,248 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include "MmapIO.h"
+#include "utils/log.h"
+
+// files can be far bigger than the address space, so only this much is
+// mapped at once. Must be a multiple of the page size.
+#define MAP_WINDOW        (64 * 1024 * 1024)
+#define MAP_ALIGN         (1024 * 1024)
+
+// how far ahead of the read position the kernel is asked to read
+#define READAHEAD         (4 * 1024 * 1024)
+
+#define AVIO_BUFFER_SIZE  32768
+
+bool MmapIO::s_enabled = false;
+
+// Touching a mapped page which can't be read, because the file has been
+// truncated or the storage has failed, raises SIGBUS. While a thread is
+// copying out of the map the fault is turned into a read error, and
+// anywhere else it's left to kill us as before.
+static thread_local sigjmp_buf *volatile t_bus_guard = nullptr;
+static struct sigaction s_old_bus_action;
+
+static void bus_handler(int sig, siginfo_t *info, void *context)
+{
+  if(t_bus_guard)
+    siglongjmp(*t_bus_guard, 1);
+
+  // not ours, so fault again with whatever was there before
+  sigaction(SIGBUS, &s_old_bus_action, nullptr);
+}
+
+static void install_bus_handler()
+{
+  static std::once_flag once;
+  std::call_once(once, []() {
+    struct sigaction sa = {};
+    sa.sa_sigaction = bus_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGBUS, &sa, &s_old_bus_action);
+  });
+}
+
+MmapIO::MmapIO(const std::string &filename)
+{
+  m_fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if(m_fd == -1)
+    throw "MmapIO: open failed";
+
+  struct stat st;
+  if(fstat(m_fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+  {
+    close(m_fd);
+    throw "MmapIO: not a regular file";
+  }
+  m_size = st.st_size;
+
+  install_bus_handler();
+
+  unsigned char *buffer = (unsigned char*)av_malloc(AVIO_BUFFER_SIZE);
+  if(buffer)
+    m_avio = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 0, this, read_cb, nullptr, seek_cb);
+
+  if(!m_avio)
+  {
+    av_free(buffer);
+    close(m_fd);
+    throw "avio_alloc_context failed";
+  }
+
+  m_avio->seekable = AVIO_SEEKABLE_NORMAL;
+}
+
+MmapIO::~MmapIO()
+{
+  Unmap();
+
+  close(m_fd);
+
+  av_free(m_avio->buffer);
+  avio_context_free(&m_avio);
+}
+
+int MmapIO::read_cb(void *opaque, uint8_t *buf, int size)
+{
+  return static_cast<MmapIO *>(opaque)->Read(buf, size);
+}
+
+int64_t MmapIO::seek_cb(void *opaque, int64_t offset, int whence)
+{
+  return static_cast<MmapIO *>(opaque)->Seek(offset, whence);
+}
+
+// The file may still be being written, or may have been cut short
+void MmapIO::UpdateSize()
+{
+  struct stat st;
+  if(fstat(m_fd, &st) == 0)
+    m_size = st.st_size;
+}
+
+void MmapIO::Unmap()
+{
+  if(m_map)
+  {
+    munmap(m_map, m_map_len);
+    m_map = nullptr;
+  }
+}
+
+// Move the window so that it starts just before pos
+bool MmapIO::Map(int64_t pos)
+{
+  Unmap();
+
+  m_map_start = pos & ~(int64_t)(MAP_ALIGN - 1);
+  m_map_len = std::min((int64_t)MAP_WINDOW, m_size - m_map_start);
+
+  void *map = mmap(nullptr, m_map_len, PROT_READ, MAP_SHARED, m_fd, m_map_start);
+  if(map == MAP_FAILED)
+  {
+    CLogLog(LOGERROR, "MmapIO: mmap at %lld failed: %s", m_map_start, strerror(errno));
+    return false;
+  }
+
+  m_map = (uint8_t *)map;
+  madvise(m_map, m_map_len, MADV_SEQUENTIAL);
+
+  // a new window always needs new advice
+  m_advised_start = m_advised_end = m_map_start;
+
+  return true;
+}
+
+// Keep the kernel reading ahead of us. Asks again once we're half way
+// through what was asked for last time, or somewhere else entirely.
+void MmapIO::Advise()
+{
+  if(m_pos >= m_advised_start && m_pos + READAHEAD / 2 < m_advised_end)
+    return;
+
+  int64_t map_end = m_map_start + m_map_len;
+  int64_t start = m_pos & ~(int64_t)(sysconf(_SC_PAGESIZE) - 1);
+  int64_t end = std::min(m_pos + READAHEAD, map_end);
+
+  madvise(m_map + (start - m_map_start), end - start, MADV_WILLNEED);
+
+  m_advised_start = start;
+  m_advised_end = end;
+}
+
+int MmapIO::Read(uint8_t *buf, int size)
+{
+  if(!m_map || m_pos < m_map_start || m_pos >= m_map_start + (int64_t)m_map_len)
+  {
+    UpdateSize();
+    if(m_pos >= m_size)
+      return AVERROR_EOF;
+
+    if(!Map(m_pos))
+      return AVERROR(EIO);
+  }
+
+  Advise();
+
+  int n = std::min((int64_t)size, m_map_start + (int64_t)m_map_len - m_pos);
+
+  sigjmp_buf guard;
+  if(sigsetjmp(guard, 1))
+  {
+    t_bus_guard = nullptr;
+    CLogLog(LOGERROR, "MmapIO: can't read at %lld, file truncated or i/o error", m_pos);
+
+    // what's left of the window can't be trusted either
+    Unmap();
+    return AVERROR(EIO);
+  }
+
+  // the fences stop the compiler moving the copy outside the guard
+  t_bus_guard = &guard;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  memcpy(buf, m_map + (m_pos - m_map_start), n);
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  t_bus_guard = nullptr;
+
+  m_pos += n;
+
+  return n;
+}
+
+int64_t MmapIO::Seek(int64_t offset, int whence)
+{
+  whence &= ~AVSEEK_FORCE;
+
+  int64_t pos;
+  switch(whence)
+  {
+  case AVSEEK_SIZE: UpdateSize(); return m_size;
+  case SEEK_SET: pos = offset; break;
+  case SEEK_CUR: pos = m_pos + offset; break;
+  case SEEK_END: UpdateSize(); pos = m_size + offset; break;
+  default:
+    return AVERROR(EINVAL);
+  }
+
+  if(pos < 0)
+    return AVERROR(EINVAL);
+
+  m_pos = pos;
+  return pos;
+}
@@ -0,0 +1,68 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include "utils/NoMoveCopy.h"
+
+// Reads a local file through a window mapped into memory rather than with
+// read() calls. The window moves with the read position, and the kernel is
+// told to read ahead of it, so most reads are page cache hits.
+// A fault while copying out of the window, if the file is truncated or the
+// storage fails, is caught and returned as a read error.
+class MmapIO : NoMoveCopy
+{
+public:
+  MmapIO(const std::string &filename);
+  ~MmapIO();
+
+  AVIOContext *GetContext() { return m_avio; }
+
+  static void SetEnabled(bool enabled) { s_enabled = enabled; }
+  static bool Enabled() { return s_enabled; }
+
+private:
+  void UpdateSize();
+  bool Map(int64_t pos);
+  void Unmap();
+  void Advise();
+  int Read(uint8_t *buf, int size);
+  int64_t Seek(int64_t offset, int whence);
+
+  static int read_cb(void *opaque, uint8_t *buf, int size);
+  static int64_t seek_cb(void *opaque, int64_t offset, int whence);
+
+  AVIOContext               *m_avio = nullptr;
+  int                       m_fd = -1;
+  int64_t                   m_size = 0;
+  int64_t                   m_pos = 0;
+  uint8_t                   *m_map = nullptr;
+  int64_t                   m_map_start = 0;
+  size_t                    m_map_len = 0;
+  int64_t                   m_advised_start = 0;
+  int64_t                   m_advised_end = 0;
+
+  static bool               s_enabled;
+};
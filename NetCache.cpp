@@ -0,0 +1,427 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include "NetCache.h"
+#include "utils/log.h"
+
+#define BLOCK_SIZE              65536
+#define AVIO_BUFFER_SIZE        32768
+#define INITIAL_READAHEAD       (1024 * 1024 / BLOCK_SIZE)
+#define MAX_RETRIES             4
+#define RETRY_DELAY             250   // ms, doubled on each retry
+
+size_t NetCache::s_size = 16 * 1024 * 1024;
+size_t NetCache::s_readahead = 4 * 1024 * 1024;
+std::string NetCache::s_spill_dir;
+
+NetCache::NetCache(const std::string &url, AVDictionary **options, const AVIOInterruptCB &interrupt)
+:
+m_interrupt(interrupt)
+{
+  AVIOInterruptCB cb = { abort_cb, this };
+  if(avio_open2(&m_source, url.c_str(), AVIO_FLAG_READ, &cb, options) < 0)
+    throw "avio_open2 failed";
+
+  m_size = avio_size(m_source);
+
+  m_max_blocks = std::max(s_size / BLOCK_SIZE, (size_t)4);
+  m_max_readahead = std::clamp(s_readahead / BLOCK_SIZE, (size_t)1, m_max_blocks / 2);
+  m_readahead = std::min((size_t)INITIAL_READAHEAD, m_max_readahead);
+
+  if(!s_spill_dir.empty())
+  {
+    std::string path = s_spill_dir + "/omxplayer-XXXXXX";
+    m_spill_fd = mkstemp(&path[0]);
+    if(m_spill_fd != -1)
+    {
+      unlink(path.c_str());
+    }
+    else
+    {
+      CLogLog(LOGWARNING, "NetCache: can't create spill file in %s", s_spill_dir.c_str());
+    }
+  }
+
+  unsigned char *buffer = (unsigned char*)av_malloc(AVIO_BUFFER_SIZE);
+  if(buffer)
+    m_avio = avio_alloc_context(buffer, AVIO_BUFFER_SIZE, 0, this, read_cb, nullptr, seek_cb);
+
+  if(!m_avio)
+  {
+    av_free(buffer);
+    avio_closep(&m_source);
+    if(m_spill_fd != -1)
+      close(m_spill_fd);
+    throw "avio_alloc_context failed";
+  }
+
+  m_avio->seekable = m_source->seekable;
+
+  CLogLog(LOGDEBUG, "NetCache: %s size %lld, cache %zu blocks, read-ahead %zu blocks",
+      url.c_str(), m_size, m_max_blocks, m_max_readahead);
+
+  pthread_cond_init(&m_cond, nullptr);
+
+  Create(THREAD_DEMUX, "netcache");
+}
+
+NetCache::~NetCache()
+{
+  m_bAbort = true;
+
+  Lock();
+  pthread_cond_broadcast(&m_cond);
+  UnLock();
+
+  StopThread();
+
+  CLogLog(LOGINFO, "NetCache: %u hits, %u misses", m_hits, m_misses);
+
+  for(auto &b : m_blocks)
+    delete b.second;
+
+  if(m_spill_fd != -1)
+    close(m_spill_fd);
+
+  avio_closep(&m_source);
+  av_free(m_avio->buffer);
+  avio_context_free(&m_avio);
+
+  pthread_cond_destroy(&m_cond);
+}
+
+int NetCache::abort_cb(void *opaque)
+{
+  return static_cast<NetCache *>(opaque)->m_bAbort;
+}
+
+int NetCache::read_cb(void *opaque, uint8_t *buf, int size)
+{
+  return static_cast<NetCache *>(opaque)->Read(buf, size);
+}
+
+int64_t NetCache::seek_cb(void *opaque, int64_t offset, int whence)
+{
+  return static_cast<NetCache *>(opaque)->Seek(offset, whence);
+}
+
+// The first block in the read-ahead window which we don't have yet, or -1.
+// Call with lock held.
+// A dropped connection or failed range request is usually transient, so the
+// block is asked for again after a short wait. Only when that keeps failing
+// is the error passed on to the reader. Called with the lock held.
+void NetCache::Retry(int64_t index)
+{
+  m_source_pos = -1; // the next attempt is a fresh range request
+
+  if(m_retries >= MAX_RETRIES)
+  {
+    CLogLog(LOGERROR, "NetCache: giving up on block %lld", (long long)index);
+    m_retries = 0;
+    m_error = true;
+    return;
+  }
+
+  int delay = RETRY_DELAY << m_retries++;
+  CLogLog(LOGWARNING, "NetCache: retrying block %lld in %dms", (long long)index, delay);
+
+  struct timespec endtime;
+  clock_gettime(CLOCK_REALTIME, &endtime);
+  endtime.tv_sec += delay / 1000;
+  endtime.tv_nsec += (delay % 1000) * 1000000;
+  if(endtime.tv_nsec >= 1000000000)
+  {
+    endtime.tv_sec++;
+    endtime.tv_nsec -= 1000000000;
+  }
+
+  while(!m_bAbort && pthread_cond_timedwait(&m_cond, &m_lock, &endtime) != ETIMEDOUT) {}
+}
+
+int64_t NetCache::NextWanted()
+{
+  if(m_error)
+    return -1;
+
+  int64_t first = m_pos / BLOCK_SIZE;
+  for(int64_t i = first; i < first + (int64_t)m_readahead; i++)
+  {
+    if(m_eof_block >= 0 && i >= m_eof_block)
+      break;
+
+    if(m_blocks.count(i) == 0 && m_spilled.count(i) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+void NetCache::Process()
+{
+  while(true)
+  {
+    int64_t index = -1;
+
+    Lock();
+    while(!m_bAbort && (index = NextWanted()) < 0)
+      pthread_cond_wait(&m_cond, &m_lock);
+    UnLock();
+
+    if(m_bAbort)
+      break;
+
+    // anywhere other than straight on is a new range request
+    int64_t offset = index * BLOCK_SIZE;
+    if(offset != m_source_pos)
+    {
+      if(avio_seek(m_source, offset, SEEK_SET) < 0)
+      {
+        Lock();
+        Retry(index);
+        pthread_cond_broadcast(&m_cond);
+        UnLock();
+        continue;
+      }
+      m_source_pos = offset;
+    }
+
+    Block *block = new Block();
+    block->data.resize(BLOCK_SIZE);
+    int n = avio_read(m_source, block->data.data(), BLOCK_SIZE);
+
+    Lock();
+    if(n == AVERROR_EOF || n == 0)
+    {
+      m_eof_block = index;
+      delete block;
+    }
+    else if(n < 0 || (n < BLOCK_SIZE && m_size > 0 && offset + n < m_size))
+    {
+      // a short read before the end is a dropped connection
+      m_source_pos = -1;
+      delete block;
+      if(!m_bAbort)
+        Retry(index);
+    }
+    else
+    {
+      m_retries = 0;
+      m_source_pos = offset + n;
+      if(n < BLOCK_SIZE)
+        m_eof_block = index + 1;
+
+      block->data.resize(n);
+      Insert(index, block);
+    }
+    pthread_cond_broadcast(&m_cond);
+    UnLock();
+  }
+}
+
+// call with lock held
+void NetCache::Insert(int64_t index, Block *block)
+{
+  auto it = m_blocks.find(index);
+  if(it != m_blocks.end())
+  {
+    delete it->second;
+    it->second = block;
+  }
+  else
+  {
+    m_blocks.emplace(index, block);
+  }
+
+  block->last_used = ++m_clock;
+  Evict();
+}
+
+// Drop the least recently used blocks outside the read-ahead window until
+// we're back under the limit. Call with lock held.
+void NetCache::Evict()
+{
+  int64_t first = m_pos / BLOCK_SIZE;
+  int64_t last = first + m_readahead;
+
+  while(m_blocks.size() > m_max_blocks)
+  {
+    auto victim = m_blocks.end();
+    for(auto it = m_blocks.begin(); it != m_blocks.end(); ++it)
+    {
+      if(it->first >= first && it->first < last)
+        continue;
+
+      if(victim == m_blocks.end() || it->second->last_used < victim->second->last_used)
+        victim = it;
+    }
+
+    if(victim == m_blocks.end())
+      break;
+
+    Block *block = victim->second;
+    if(m_spill_fd != -1 && m_spilled.count(victim->first) == 0)
+    {
+      ssize_t len = block->data.size();
+      if(pwrite(m_spill_fd, block->data.data(), len, victim->first * BLOCK_SIZE) == len)
+        m_spilled.emplace(victim->first, len);
+    }
+
+    delete block;
+    m_blocks.erase(victim);
+  }
+}
+
+// call with lock held
+NetCache::Block *NetCache::Find(int64_t index)
+{
+  auto it = m_blocks.find(index);
+  if(it != m_blocks.end())
+    return it->second;
+
+  auto spilled = m_spilled.find(index);
+  if(spilled == m_spilled.end())
+    return nullptr;
+
+  Block *block = new Block();
+  block->data.resize(spilled->second);
+  if(pread(m_spill_fd, block->data.data(), spilled->second, index * BLOCK_SIZE) != spilled->second)
+  {
+    m_spilled.erase(spilled);
+    delete block;
+    return nullptr;
+  }
+
+  Insert(index, block);
+  return block;
+}
+
+int NetCache::Read(uint8_t *buf, int size)
+{
+  Lock();
+
+  int64_t index = m_pos / BLOCK_SIZE;
+  bool missed = false;
+  Block *block;
+
+  while(!(block = Find(index)))
+  {
+    int error = 0;
+    if(m_eof_block >= 0 && index >= m_eof_block)
+      error = AVERROR_EOF;
+    else if(m_error)
+      error = AVERROR(EIO);
+    else if(m_bAbort || (m_interrupt.callback && m_interrupt.callback(m_interrupt.opaque)))
+      error = AVERROR_EXIT;
+
+    if(error)
+    {
+      UnLock();
+      return error;
+    }
+
+    // the demuxer has caught up with us, so read further ahead from now on
+    if(!missed)
+    {
+      missed = true;
+      m_misses++;
+      m_readahead = std::min(m_readahead * 2, m_max_readahead);
+      pthread_cond_broadcast(&m_cond);
+    }
+
+    // wake up now and then to check the interrupt callback
+    struct timespec endtime;
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    endtime.tv_nsec += 100000000;
+    if(endtime.tv_nsec >= 1000000000)
+    {
+      endtime.tv_sec++;
+      endtime.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&m_cond, &m_lock, &endtime);
+  }
+
+  if(!missed)
+    m_hits++;
+
+  int offset = m_pos - index * BLOCK_SIZE;
+  int n = std::min(size, (int)block->data.size() - offset);
+  if(n <= 0)
+  {
+    UnLock();
+    return AVERROR_EOF;
+  }
+
+  memcpy(buf, block->data.data() + offset, n);
+  block->last_used = ++m_clock;
+  m_pos += n;
+
+  // moving on to the next block opens up a gap at the end of the window
+  if(m_pos % BLOCK_SIZE == 0)
+    pthread_cond_signal(&m_cond);
+
+  UnLock();
+  return n;
+}
+
+int64_t NetCache::Seek(int64_t offset, int whence)
+{
+  whence &= ~AVSEEK_FORCE;
+
+  if(whence == AVSEEK_SIZE)
+    return m_size >= 0 ? m_size : AVERROR(ENOSYS);
+
+  int64_t pos;
+  switch(whence)
+  {
+  case SEEK_SET: pos = offset; break;
+  case SEEK_CUR: pos = m_pos + offset; break;
+  case SEEK_END:
+    if(m_size < 0)
+      return AVERROR(ENOSYS);
+    pos = m_size + offset;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+
+  if(pos < 0)
+    return AVERROR(EINVAL);
+
+  Lock();
+  m_pos = pos;
+  m_error = false; // worth another try from here
+  m_retries = 0;
+  pthread_cond_signal(&m_cond);
+  UnLock();
+
+  return pos;
+}
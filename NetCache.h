@@ -0,0 +1,97 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include "OMXThread.h"
+
+// A byte cache which sits between a network stream and the demuxer. A
+// thread keeps reading ahead of the demuxer in fixed sized blocks, so a
+// short stall on the network doesn't reach the player, and blocks already
+// read are kept so that short backward seeks don't go back to the server.
+// A block which isn't cached is fetched with a seek on the underlying
+// stream, which for http is a range request.
+//
+// The read-ahead starts small and doubles, up to the configured limit, each
+// time the demuxer catches up with it. Blocks pushed out of memory can
+// optionally be spilled to a file on disk.
+class NetCache : public OMXThread
+{
+public:
+  NetCache(const std::string &url, AVDictionary **options, const AVIOInterruptCB &interrupt);
+  ~NetCache() override;
+
+  AVIOContext *GetContext() { return m_avio; }
+
+  static void SetSize(size_t size, size_t readahead) { s_size = size; s_readahead = readahead; }
+  static void SetSpillDir(const char *dir) { s_spill_dir.assign(dir); }
+  static bool Enabled() { return s_size > 0; }
+
+private:
+  struct Block
+  {
+    std::vector<uint8_t> data;
+    unsigned int         last_used = 0;
+  };
+
+  void Process() override;
+  int64_t NextWanted();
+  void Retry(int64_t index);
+  void Insert(int64_t index, Block *block);
+  void Evict();
+  Block *Find(int64_t index);
+  int Read(uint8_t *buf, int size);
+  int64_t Seek(int64_t offset, int whence);
+
+  static int read_cb(void *opaque, uint8_t *buf, int size);
+  static int64_t seek_cb(void *opaque, int64_t offset, int whence);
+  static int abort_cb(void *opaque);
+
+  AVIOContext              *m_source = nullptr;
+  AVIOContext              *m_avio = nullptr;
+  AVIOInterruptCB          m_interrupt;
+  pthread_cond_t           m_cond;
+  std::map<int64_t, Block*> m_blocks;
+  std::map<int64_t, int>   m_spilled;   // block index -> length
+  int                      m_spill_fd = -1;
+  size_t                   m_max_blocks;
+  size_t                   m_readahead;  // in blocks
+  size_t                   m_max_readahead;
+  int64_t                  m_size = -1;
+  int64_t                  m_pos = 0;
+  int64_t                  m_source_pos = 0;
+  int64_t                  m_eof_block = -1;
+  unsigned int             m_clock = 0;
+  unsigned int             m_hits = 0;
+  unsigned int             m_misses = 0;
+  int                      m_retries = 0;
+  bool                     m_error = false;
+
+  static size_t            s_size;
+  static size_t            s_readahead;
+  static std::string       s_spill_dir;
+};
@@ -973,6 +973,12 @@ unsigned int COMXAudio::GetSpace()
   return free;
 }
 
+// timeout in milliseconds
+bool COMXAudio::WaitForSpace(unsigned int size, long timeout)
+{
+  return m_omx_decoder.WaitForInputSpace(size, timeout);
+}
+
 int64_t COMXAudio::GetDelay()
 {
   CSingleLock lock (m_critSection);
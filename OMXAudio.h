@@ -51,6 +51,8 @@ public:
   bool hwdecode = false;
   bool is_live = false;
   unsigned int queue_size = 3 * 1024 * 1024;
+  float queue_min_time = 0.0f;
+  float queue_max_time = 10.0f;
 };
 
 class COMXAudio : NoMoveCopy
@@ -65,6 +67,7 @@ public:
 
   bool AddPackets(const void* data, unsigned int len, int64_t pts, unsigned int frame_size);
   unsigned int GetSpace();
+  bool WaitForSpace(unsigned int size, long timeout);
 
   void SetVolume(float nVolume);
   float GetVolume();
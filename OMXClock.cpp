@@ -19,6 +19,7 @@
  */
 
 #include <errno.h>
+#include <algorithm>
 
 #include "OMXClock.h"
 #include "utils/log.h"
@@ -26,15 +27,22 @@
 
 #define OMX_PRE_ROLL 200
 
+// how often the clock model is checked against the hardware, in us
+#define CLOCK_SYNC_INTERVAL   250000
+// ... after something has changed until the hardware is seen to be running
+#define CLOCK_SETTLE_INTERVAL 40000
+// errors bigger than this are corrected at once rather than slewed away
+#define CLOCK_MAX_SLEW        50000
+// the most the rate is nudged by while slewing
+#define CLOCK_SLEW_RATE       0.1
+
 OMXClock::OMXClock()
 :
 m_pause(false),
 m_omx_speed(DVD_PLAYSPEED_NORMAL),
 m_WaitMask(0),
 m_eState(OMX_TIME_ClockStateStopped),
-m_eClock(OMX_TIME_RefClockNone),
-m_last_media_time(0),
-m_last_media_time_read(0)
+m_eClock(OMX_TIME_RefClockNone)
 {
   if(!m_omx_clock.Initialize("OMX.broadcom.clock", OMX_IndexParamOtherInit))
     throw "Failed to initialise media clock";
@@ -94,7 +102,7 @@ bool OMXClock::SetReferenceClock(bool has_audio)
     }
     m_eClock = refClock.eClock;
   }
-  m_last_media_time = 0;
+  InvalidateModel();
 
   return ret;
 }
@@ -117,7 +125,7 @@ bool OMXClock::StateExecute()
     }
   }
 
-  m_last_media_time = 0;
+  InvalidateModel();
 
   return true;
 }
@@ -132,7 +140,7 @@ void OMXClock::StateIdle()
   if(m_omx_clock.GetState() != OMX_StateIdle)
     m_omx_clock.SetStateForComponent(OMX_StateIdle);
 
-  m_last_media_time = 0;
+  InvalidateModel();
 }
 
 COMXCoreComponent *OMXClock::GetOMXClock()
@@ -164,7 +172,7 @@ bool  OMXClock::Stop()
   }
   m_eState = clock.eState;
 
-  m_last_media_time = 0;
+  InvalidateModel();
 
   return true;
 }
@@ -190,7 +198,7 @@ bool OMXClock::Step(int steps /* = 1 */)
     return false;
   }
 
-  m_last_media_time = 0;
+  InvalidateModel();
 
   CLogLog(LOGDEBUG, "OMXClock::Step (%d)", steps);
   return true;
@@ -234,47 +242,135 @@ bool OMXClock::Reset(bool has_video, bool has_audio)
     }
   }
 
-  m_last_media_time = 0;
+  InvalidateModel();
 
   return true;
 }
 
-int64_t OMXClock::GetMediaTime()
+bool OMXClock::GetHardwareTime(int64_t &pts)
 {
-  int64_t pts = 0;
-  if(m_omx_clock.GetComponent() == nullptr)
-    return 0;
+  OMX_TIME_CONFIG_TIMESTAMPTYPE timeStamp;
+  OMX_INIT_STRUCTURE(timeStamp);
+  timeStamp.nPortIndex = m_omx_clock.GetInputPort();
 
-  int64_t now = GetAbsoluteClock();
-  if (now - m_last_media_time_read > 100000 || m_last_media_time == 0)
+  OMX_ERRORTYPE omx_err = m_omx_clock.GetConfig(OMX_IndexConfigTimeCurrentMediaTime, &timeStamp);
+  if(omx_err != OMX_ErrorNone)
   {
-    CSingleLock lock(m_lock);
+    CLogLog(LOGERROR, "OMXClock::MediaTime error getting OMX_IndexConfigTimeCurrentMediaTime");
+    return false;
+  }
+
+  pts = FromOMXTime(timeStamp.nTimestamp);
+  return true;
+}
 
-    OMX_ERRORTYPE omx_err = OMX_ErrorNone;
+int64_t OMXClock::ModelTime(int64_t now)
+{
+  unsigned int seq;
+  int64_t media, host;
+  double rate;
 
-    OMX_TIME_CONFIG_TIMESTAMPTYPE timeStamp;
-    OMX_INIT_STRUCTURE(timeStamp);
-    timeStamp.nPortIndex = m_omx_clock.GetInputPort();
+  do
+  {
+    seq = m_model_seq.load(std::memory_order_acquire);
+    media = m_ref_media.load(std::memory_order_relaxed);
+    host = m_ref_host.load(std::memory_order_relaxed);
+    rate = m_ref_rate.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while((seq & 1) || seq != m_model_seq.load(std::memory_order_relaxed));
+
+  // now may have been read just before another thread synced the model
+  return media + (int64_t)(std::max(now - host, (int64_t)0) * rate);
+}
 
-    omx_err = m_omx_clock.GetConfig(OMX_IndexConfigTimeCurrentMediaTime, &timeStamp);
-    if(omx_err != OMX_ErrorNone)
-    {
-      CLogLog(LOGERROR, "OMXClock::MediaTime error getting OMX_IndexConfigTimeCurrentMediaTime");
-      return 0;
-    }
+// m_lock must be held
+void OMXClock::SetModel(int64_t media, int64_t host, double rate, int64_t next_sync)
+{
+  m_model_seq.fetch_add(1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  m_ref_media.store(media, std::memory_order_relaxed);
+  m_ref_host.store(host, std::memory_order_relaxed);
+  m_ref_rate.store(rate, std::memory_order_relaxed);
+  m_model_seq.fetch_add(1, std::memory_order_release);
+
+  m_next_sync = next_sync;
+}
 
-    pts = FromOMXTime(timeStamp.nTimestamp);
-    //CLogLog(LOGINFO, "OMXClock::MediaTime %.2f (%.2f, %.2f)", pts, m_last_media_time, now - m_last_media_time_read);
-    m_last_media_time = pts;
-    m_last_media_time_read = now;
+// m_lock must be held
+bool OMXClock::SyncModel(int64_t now)
+{
+  int64_t hw;
+  if(!GetHardwareTime(hw))
+    return false;
+
+  bool valid = m_next_sync != 0;
+  int64_t model = valid ? ModelTime(now) : hw;
+  int64_t error = hw - model;
+
+  // the clock doesn't move while waiting for a start time, so don't assume
+  // it's running until it has been seen to
+  bool running = m_clock_speed > 0.0f && m_last_hw_valid && hw != m_last_hw_time;
+
+  m_last_hw_time = hw;
+  m_last_hw_valid = true;
+
+  if(!valid || error > CLOCK_MAX_SLEW || error < -CLOCK_MAX_SLEW)
+  {
+    // too far out, start again from the hardware
+    SetModel(hw, now, running ? m_clock_speed : 0.0,
+        now + (running ? CLOCK_SYNC_INTERVAL : CLOCK_SETTLE_INTERVAL));
+  }
+  else if(!running)
+  {
+    // hold rather than step back
+    SetModel(std::max(hw, model), now, 0.0,
+        now + (m_clock_speed > 0.0f ? CLOCK_SETTLE_INTERVAL : CLOCK_SYNC_INTERVAL));
   }
   else
   {
-    double speed = m_pause ? 0.0 : m_omx_speed;
-    pts = m_last_media_time + (now - m_last_media_time_read) * speed;
-    //CLogLog(LOGINFO, "OMXClock::MediaTime cached %.2f (%.2f, %.2f)", pts, m_last_media_time, now - m_last_media_time_read);
+    // carry on from where the model is now, and aim to be back in step
+    // with the hardware by the next check
+    double limit = m_clock_speed * CLOCK_SLEW_RATE;
+    double slew = std::min(std::max((double)error / CLOCK_SYNC_INTERVAL, -limit), limit);
+    SetModel(model, now, m_clock_speed + slew, now + CLOCK_SYNC_INTERVAL);
   }
-  return pts;
+
+  return true;
+}
+
+// Something changed which the hardware will take a moment to reflect. Carry
+// on from media without moving until it has been seen to run again.
+void OMXClock::HoldModel(int64_t media)
+{
+  int64_t now = GetAbsoluteClock();
+  m_last_hw_valid = false;
+  SetModel(media, now, 0.0, now + CLOCK_SETTLE_INTERVAL);
+}
+
+void OMXClock::InvalidateModel()
+{
+  m_last_hw_valid = false;
+  m_next_sync = 0;
+}
+
+int64_t OMXClock::GetMediaTime()
+{
+  if(m_omx_clock.GetComponent() == nullptr)
+    return 0;
+
+  int64_t now = GetAbsoluteClock();
+  int64_t next_sync = m_next_sync;
+  if (next_sync == 0 || now >= next_sync)
+  {
+    CSingleLock lock(m_lock);
+
+    // another thread may have got there first
+    next_sync = m_next_sync;
+    if ((next_sync == 0 || now >= next_sync) && !SyncModel(now))
+      return 0;
+  }
+
+  return ModelTime(now);
 }
 
 // Set the media time, so calls to get media time use the updated value,
@@ -310,7 +406,7 @@ bool OMXClock::SetMediaTime(int64_t pts)
   CLogLog(LOGDEBUG, "OMXClock::SetMediaTime set config %s = %lld", index == OMX_IndexConfigTimeCurrentAudioReference ?
        "OMX_IndexConfigTimeCurrentAudioReference":"OMX_IndexConfigTimeCurrentVideoReference", pts);
 
-  m_last_media_time = 0;
+  HoldModel(pts);
 
   return true;
 }
@@ -326,8 +422,6 @@ bool OMXClock::Pause()
 
     if(SetSpeed(0.0f))
       m_pause = true;
-
-    m_last_media_time = 0;
   }
   return m_pause == true;
 }
@@ -343,8 +437,6 @@ bool OMXClock::Resume()
 
     if(SetSpeed(m_omx_speed))
       m_pause = false;
-
-    m_last_media_time = 0;
   }
   return m_pause == false;
 }
@@ -373,7 +465,18 @@ bool OMXClock::SetSpeed(float speed)
     return false;
   }
 
-  m_last_media_time = 0;
+  if(m_next_sync != 0)
+  {
+    int64_t now = GetAbsoluteClock();
+
+    // a small change to the speed of a running clock (see LatencyController)
+    // needn't stop the model until the hardware is seen to move again
+    if(speed > 0.0f && m_clock_speed > 0.0f && m_last_hw_valid)
+      SetModel(ModelTime(now), now, speed, m_next_sync);
+    else
+      HoldModel(ModelTime(now));
+  }
+  m_clock_speed = speed;
 
   return true;
 }
@@ -405,7 +508,7 @@ bool OMXClock::HDMIClockSync()
     return false;
   }
 
-  m_last_media_time = 0;
+  InvalidateModel();
 
   return true;
 }
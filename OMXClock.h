@@ -20,6 +20,8 @@
  *
  */
 
+#include <atomic>
+
 #include "OMXCore.h"
 #include "utils/SingleLock.h"
 #include "utils/NoMoveCopy.h"
@@ -51,8 +53,22 @@ protected:
   OMX_TIME_REFCLOCKTYPE m_eClock;
 private:
   COMXCoreComponent m_omx_clock;
-  int64_t            m_last_media_time;
-  int64_t            m_last_media_time_read;
+
+  // Software model of the media clock so that it doesn't have to be asked
+  // over IPC every time. The media time is
+  //   m_ref_media + (now - m_ref_host) * m_ref_rate
+  // It's written with m_lock held and read without, m_model_seq being odd
+  // while it's being written. Every so often it's checked against the
+  // hardware and the rate nudged to work off small errors, so that the time
+  // read from it doesn't go backwards.
+  std::atomic<unsigned int> m_model_seq{0};
+  std::atomic<int64_t> m_ref_media{0};
+  std::atomic<int64_t> m_ref_host{0};
+  std::atomic<double>  m_ref_rate{0.0};
+  std::atomic<int64_t> m_next_sync{0};  // 0 when the model is invalid
+  int64_t              m_last_hw_time = 0;
+  bool                 m_last_hw_valid = false;
+  float                m_clock_speed  = DVD_PLAYSPEED_NORMAL; // scale set on the hardware
 
 public:
   OMXClock();
@@ -78,4 +94,10 @@ public:
 private:
   void SetClockPorts(OMX_TIME_CONFIG_CLOCKSTATETYPE *clock, bool has_video, bool has_audio);
   bool SetReferenceClock(bool has_audio);
+  bool GetHardwareTime(int64_t &pts);
+  int64_t ModelTime(int64_t now);
+  void SetModel(int64_t media, int64_t host, double rate, int64_t next_sync);
+  bool SyncModel(int64_t now);
+  void HoldModel(int64_t media);
+  void InvalidateModel();
 };
@@ -36,6 +36,20 @@ void OMXControl::dispatch()
     dbus_connection_read_write(bus, 0);
 }
 
+// the socket to watch for incoming messages, or -1
+int OMXControl::getFd() const
+{
+  int fd = -1;
+  if (!bus || !dbus_connection_get_unix_fd(bus, &fd))
+    return -1;
+  return fd;
+}
+
+// messages which have already been read from the socket won't wake a poll
+bool OMXControl::pending() const
+{
+  return bus && dbus_connection_get_dispatch_status(bus) == DBUS_DISPATCH_DATA_REMAINS;
+}
 
 OMXControl::operator bool() const
 {
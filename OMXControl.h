@@ -58,6 +58,8 @@ public:
   ~OMXControl();
   bool connect(const char *dbus_name);
   enum ControlFlow getEvent();
+  int getFd() const;
+  bool pending() const;
   operator bool() const;
 private:
   void dispatch();
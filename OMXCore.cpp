@@ -360,6 +360,24 @@ OMX_BUFFERHEADERTYPE *COMXCoreComponent::GetInputBuffer(long timeout /*=200*/)
   return omx_input_buffer;
 }
 
+// timeout in milliseconds. Returns true once there are at least size bytes
+// of free input buffers
+bool COMXCoreComponent::WaitForInputSpace(unsigned int size, long timeout)
+{
+  pthread_mutex_lock(&m_omx_input_mutex);
+  struct timespec endtime;
+  clock_gettime(CLOCK_REALTIME, &endtime);
+  add_timespecs(endtime, timeout);
+  while (GetInputBufferSpace() < size)
+  {
+    if (pthread_cond_timedwait(&m_input_buffer_cond, &m_omx_input_mutex, &endtime) != 0)
+      break;
+  }
+  bool ret = GetInputBufferSpace() >= size;
+  pthread_mutex_unlock(&m_omx_input_mutex);
+  return ret;
+}
+
 
 OMX_ERRORTYPE COMXCoreComponent::WaitForInputDone(long timeout /*=200*/)
 {
@@ -127,6 +127,7 @@ public:
   void FlushOutput();
 
   OMX_BUFFERHEADERTYPE *GetInputBuffer(long timeout=200);
+  bool WaitForInputSpace(unsigned int size, long timeout);
 
   OMX_ERRORTYPE AllocInputBuffers();
 
@@ -0,0 +1,126 @@
+/*
+ *      Copyright (C) 2005-2008 Team XBMC
+ *      http://www.xbmc.org
+ *
+ *  This Program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This Program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with XBMC; see the file COPYING.  If not, write to
+ *  the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.
+ *  http://www.gnu.org/copyleft/gpl.html
+ *
+ */
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "OMXPacket.h"
+
+// upper limit on the number of idle packets kept for reuse
+#define MAX_POOLED_PACKETS 1024
+
+std::mutex                OMXPacket::s_pool_lock;
+std::vector<OMXPacket *>  OMXPacket::s_pool;
+std::atomic<unsigned int> OMXPacket::s_pool_hits{0};
+std::atomic<unsigned int> OMXPacket::s_pool_misses{0};
+
+OMXPacket::OMXPacket()
+:
+codec_type(AVMEDIA_TYPE_UNKNOWN),
+stream_type_index(-1)
+{
+  avpkt = av_packet_alloc();
+  if(!avpkt) throw "Memory Error";
+
+  avpkt->duration = AV_NOPTS_VALUE;
+  avpkt->size = 0;
+  avpkt->data = nullptr;
+  avpkt->stream_index = -1;
+}
+
+
+OMXPacket::~OMXPacket()
+{
+  av_packet_free(&avpkt);
+}
+
+void OMXPacket::Reset()
+{
+  av_packet_unref(avpkt);
+
+  avpkt->duration = AV_NOPTS_VALUE;
+  avpkt->stream_index = -1;
+
+  hints.reset();
+  codec_type = AVMEDIA_TYPE_UNKNOWN;
+  stream_type_index = -1;
+}
+
+OMXPacket *OMXPacket::Alloc()
+{
+  {
+    std::lock_guard<std::mutex> lock(s_pool_lock);
+    if(!s_pool.empty())
+    {
+      OMXPacket *pkt = s_pool.back();
+      s_pool.pop_back();
+      s_pool_hits++;
+      return pkt;
+    }
+  }
+
+  s_pool_misses++;
+  return new OMXPacket();
+}
+
+void OMXPacket::Free(OMXPacket *pkt)
+{
+  if(!pkt)
+    return;
+
+  pkt->Reset();
+
+  {
+    std::lock_guard<std::mutex> lock(s_pool_lock);
+    if(s_pool.size() < MAX_POOLED_PACKETS)
+    {
+      s_pool.push_back(pkt);
+      return;
+    }
+  }
+
+  delete pkt;
+}
+
+// Returns a new packet which shares src's data
+OMXPacket *OMXPacket::Ref(const OMXPacket *src)
+{
+  OMXPacket *pkt = Alloc();
+  if(av_packet_ref(pkt->avpkt, src->avpkt) < 0)
+  {
+    Free(pkt);
+    return nullptr;
+  }
+
+  pkt->hints = src->hints;
+  pkt->codec_type = src->codec_type;
+  pkt->stream_type_index = src->stream_type_index;
+  return pkt;
+}
+
+void OMXPacket::ClearPool()
+{
+  std::lock_guard<std::mutex> lock(s_pool_lock);
+  for(OMXPacket *pkt : s_pool)
+    delete pkt;
+  s_pool.clear();
+}
@@ -26,21 +26,43 @@ extern "C" {
 #include <libavutil/avutil.h>
 }
 
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <memory>
+
 #include "OMXStreamInfo.h"
 #include "utils/NoMoveCopy.h"
 
 struct AVPacket;
 
+// Packets are recycled through a free list rather than being allocated
+// and freed for every frame. Use Alloc() and Free() instead of new and
+// delete; a freed packet keeps its AVPacket, which is just unreferenced.
 class OMXPacket : NoMoveCopy
 {
 public:
-  OMXPacket();
-  ~OMXPacket();
+  static OMXPacket *Alloc();
+  static void Free(OMXPacket *pkt);
+  static OMXPacket *Ref(const OMXPacket *src);
+  static void ClearPool();
+  static unsigned int PoolHits() { return s_pool_hits; }
+  static unsigned int PoolMisses() { return s_pool_misses; }
 
   AVPacket *avpkt;
-  COMXStreamInfo hints;
+  std::shared_ptr<const COMXStreamInfo> hints; // shared by every packet of a stream
   enum AVMediaType codec_type;
   int stream_type_index = -1;
+
+private:
+  OMXPacket();
+  ~OMXPacket();
+  void Reset();
+
+  static std::mutex                  s_pool_lock;
+  static std::vector<OMXPacket *>    s_pool;
+  static std::atomic<unsigned int>   s_pool_hits;
+  static std::atomic<unsigned int>   s_pool_misses;
 };
 
 #endif
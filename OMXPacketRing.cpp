@@ -0,0 +1,161 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "OMXPacketRing.h"
+#include "OMXPacket.h"
+#include "utils/EventLoop.h"
+
+static int64_t packet_ts(OMXPacket *pkt)
+{
+  return pkt->avpkt->dts != AV_NOPTS_VALUE ? pkt->avpkt->dts : pkt->avpkt->pts;
+}
+
+OMXPacketRing::OMXPacketRing(unsigned int capacity)
+:
+m_in_ts(AV_NOPTS_VALUE),
+m_out_ts(AV_NOPTS_VALUE)
+{
+  // round up to a power of two so that the indexes can just wrap
+  unsigned int size = 2;
+  while(size < capacity)
+    size <<= 1;
+
+  m_mask = size - 1;
+  m_slots = new OMXPacket *[size];
+
+  pthread_mutex_init(&m_wait_lock, nullptr);
+  pthread_cond_init(&m_wait_cond, nullptr);
+}
+
+OMXPacketRing::~OMXPacketRing()
+{
+  Clear();
+
+  delete[] m_slots;
+
+  pthread_cond_destroy(&m_wait_cond);
+  pthread_mutex_destroy(&m_wait_lock);
+}
+
+bool OMXPacketRing::Push(OMXPacket *pkt)
+{
+  unsigned int tail = m_tail.load(std::memory_order_relaxed);
+  unsigned int used = tail - m_head.load(std::memory_order_acquire);
+
+  // keep the last slot for the eos marker
+  if(used >= (pkt ? m_mask : m_mask + 1))
+    return false;
+
+  if(pkt)
+  {
+    m_cached_size += pkt->avpkt->size;
+    if(pkt->avpkt->duration > 0)
+      m_cached_duration += pkt->avpkt->duration;
+
+    int64_t ts = packet_ts(pkt);
+    if(ts != AV_NOPTS_VALUE)
+      m_in_ts = ts;
+  }
+
+  m_slots[tail & m_mask] = pkt;
+  m_tail.store(tail + 1, std::memory_order_seq_cst);
+
+  // only an empty queue can have a sleeping consumer
+  if(m_head.load(std::memory_order_seq_cst) == tail)
+    Wake();
+
+  return true;
+}
+
+bool OMXPacketRing::Pop(OMXPacket *&pkt)
+{
+  unsigned int head = m_head.load(std::memory_order_relaxed);
+  if(head == m_tail.load(std::memory_order_acquire))
+    return false;
+
+  pkt = m_slots[head & m_mask];
+  m_head.store(head + 1, std::memory_order_seq_cst);
+
+  if(m_space_wanted && m_space_wanted.exchange(false))
+    EventLoop::Wake();
+
+  if(pkt)
+  {
+    m_cached_size -= pkt->avpkt->size;
+    if(pkt->avpkt->duration > 0)
+      m_cached_duration -= pkt->avpkt->duration;
+
+    int64_t ts = packet_ts(pkt);
+    if(ts != AV_NOPTS_VALUE)
+      m_out_ts = ts;
+  }
+
+  return true;
+}
+
+// Not every demuxer fills in packet durations so use whichever is larger
+// of their sum and the span of timestamps between the last packet taken
+// off the queue and the last one put on it.
+int64_t OMXPacketRing::GetCachedDuration()
+{
+  int64_t duration = m_cached_duration;
+
+  int64_t in_ts = m_in_ts, out_ts = m_out_ts;
+  if(in_ts != AV_NOPTS_VALUE && out_ts != AV_NOPTS_VALUE && in_ts - out_ts > duration)
+    duration = in_ts - out_ts;
+
+  return duration;
+}
+
+// Sleep until there is something in the queue or abort is set. Returns
+// false on abort.
+bool OMXPacketRing::Wait(const std::atomic<bool> &abort)
+{
+  if(!IsEmpty() || abort)
+    return !abort;
+
+  pthread_mutex_lock(&m_wait_lock);
+  while(IsEmpty() && !abort)
+    pthread_cond_wait(&m_wait_cond, &m_wait_lock);
+  pthread_mutex_unlock(&m_wait_lock);
+
+  return !abort;
+}
+
+void OMXPacketRing::Wake()
+{
+  pthread_mutex_lock(&m_wait_lock);
+  pthread_cond_broadcast(&m_wait_cond);
+  pthread_mutex_unlock(&m_wait_lock);
+}
+
+// Drop everything in the queue. This is a consumer side operation; the
+// caller must make sure the consumer thread isn't popping at the same time.
+void OMXPacketRing::Clear()
+{
+  OMXPacket *pkt;
+  while(Pop(pkt))
+    OMXPacket::Free(pkt);
+
+  m_in_ts = m_out_ts = AV_NOPTS_VALUE;
+}
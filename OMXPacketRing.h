@@ -0,0 +1,72 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "utils/NoMoveCopy.h"
+
+class OMXPacket;
+
+// Fixed capacity single producer/single consumer queue of packets. Push and
+// Pop don't take a lock; the mutex is only used to park the consumer when
+// the queue is empty and is only touched by the producer when a push takes
+// the queue from empty to non-empty.
+//
+// A producer which finds the queue full calls WantSpace(); the next Pop
+// then wakes the main event loop.
+//
+// A nullptr may be pushed as an end of stream marker. The last slot is kept
+// back for it so that it can always be queued.
+class OMXPacketRing : NoMoveCopy
+{
+public:
+  explicit OMXPacketRing(unsigned int capacity);
+  ~OMXPacketRing();
+
+  // producer
+  bool Push(OMXPacket *pkt);
+  void WantSpace() { m_space_wanted = true; }
+
+  // consumer
+  bool Pop(OMXPacket *&pkt);
+  bool Wait(const std::atomic<bool> &abort);
+  void Clear();
+
+  void Wake();
+  bool IsEmpty() { return Size() == 0; }
+  unsigned int Size() { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+  unsigned int GetCachedSize() { return m_cached_size; }
+  int64_t GetCachedDuration();
+
+private:
+  OMXPacket                 **m_slots;
+  unsigned int              m_mask;
+  std::atomic<unsigned int> m_head{0};
+  std::atomic<unsigned int> m_tail{0};
+  std::atomic<unsigned int> m_cached_size{0};
+  std::atomic<int64_t>      m_cached_duration{0};
+  std::atomic<bool>         m_space_wanted{false};
+  std::atomic<int64_t>      m_in_ts;
+  std::atomic<int64_t>      m_out_ts;
+  pthread_mutex_t           m_wait_lock;
+  pthread_cond_t            m_wait_cond;
+};
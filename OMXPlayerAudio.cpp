@@ -28,6 +28,9 @@
 #include "OMXClock.h"
 #include "utils/log.h"
 
+// upper limit on the number of packets waiting to be decoded
+#define MAX_QUEUED_PACKETS 16384
+
 OMXPlayerAudio::~OMXPlayerAudio()
 {
   m_bAbort  = true;
@@ -36,17 +39,13 @@ OMXPlayerAudio::~OMXPlayerAudio()
 
   if(ThreadHandle())
   {
-    Lock();
-    pthread_cond_broadcast(&m_packet_cond);
-    UnLock();
-
+    m_packets.Wake();
     StopThread();
   }
 
   CloseDecoder();
   CloseAudioCodec();
 
-  pthread_cond_destroy(&m_packet_cond);
   pthread_mutex_destroy(&m_lock_decoder);
 }
 
@@ -63,13 +62,15 @@ void OMXPlayerAudio::UnLockDecoder()
 OMXPlayerAudio::OMXPlayerAudio(OMXClock *av_clock, const OMXAudioConfig &config,
                                std::vector<std::string> &codecs, int active_stream)
 :
+m_packets(MAX_QUEUED_PACKETS),
 m_av_clock(av_clock),
 m_codecs(codecs),
+m_stream_index(-1),
 m_stream_count(codecs.size()),
 m_flush_requested(false),
+m_skip_pts(AV_NOPTS_VALUE),
 m_config(config)
 {
-  pthread_cond_init(&m_packet_cond, nullptr);
   pthread_mutex_init(&m_lock_decoder, nullptr);
 
   m_bAbort = false;
@@ -83,7 +84,7 @@ m_config(config)
   if(!OpenDecoder())
     throw "OMXPlayerAudio Error: Failed to open audio decoder";
 
-  Create();
+  Create(THREAD_AUDIO, "audio");
 }
 
 int OMXPlayerAudio::GetActiveStream()
@@ -95,7 +96,12 @@ bool OMXPlayerAudio::SetActiveStream(int new_index)
 {
   if(new_index < 0) return false;
   else if(new_index >= m_stream_count) return false;
-  else m_stream_index = new_index;
+
+  // the new stream carries on from where the old one got to
+  if(new_index != m_stream_index)
+    m_skip_pts = m_iCurrentPts;
+
+  m_stream_index = new_index;
 
   return true;
 }
@@ -105,9 +111,10 @@ int OMXPlayerAudio::SetActiveStreamDelta(int delta)
   int new_index = m_stream_index + delta;
 
   // wrap around
-  if(new_index < 0) m_stream_index = m_stream_count - 1;
-  else if(new_index >= m_stream_count) m_stream_index = 0;
-  else m_stream_index = new_index;
+  if(new_index < 0) new_index = m_stream_count - 1;
+  else if(new_index >= m_stream_count) new_index = 0;
+
+  SetActiveStream(new_index);
 
   return m_stream_index;
 }
@@ -122,12 +129,28 @@ bool OMXPlayerAudio::Decode(OMXPacket *pkt)
     return true;
 
   if(m_stream_index != pkt->stream_type_index)
+  {
+    m_discarded_bytes.fetch_add(pkt->avpkt->size, std::memory_order_relaxed);
     return true;
+  }
+
+  // after a stream switch skip what has already been played and after an
+  // accurate seek anything before the target
+  if(m_skip_pts != AV_NOPTS_VALUE)
+  {
+    int64_t pts = pkt->avpkt->pts != AV_NOPTS_VALUE ? pkt->avpkt->pts : pkt->avpkt->dts;
+    if(pts != AV_NOPTS_VALUE && pts <= m_skip_pts)
+    {
+      m_discarded_bytes.fetch_add(pkt->avpkt->size, std::memory_order_relaxed);
+      return true;
+    }
+    m_skip_pts = AV_NOPTS_VALUE;
+  }
 
-  int channels = pkt->hints.channels;
+  int channels = pkt->hints->channels;
 
   unsigned int old_bitrate = m_config.hints.bitrate;
-  unsigned int new_bitrate = pkt->hints.bitrate;
+  unsigned int new_bitrate = pkt->hints->bitrate;
 
   /* only check bitrate changes on AV_CODEC_ID_DTS, AV_CODEC_ID_AC3, AV_CODEC_ID_EAC3 */
   if(m_config.hints.codec != AV_CODEC_ID_DTS && m_config.hints.codec != AV_CODEC_ID_AC3 && m_config.hints.codec != AV_CODEC_ID_EAC3)
@@ -136,22 +159,22 @@ bool OMXPlayerAudio::Decode(OMXPacket *pkt)
   }
 
   // for passthrough we only care about the codec and the samplerate
-  bool minor_change = channels                 != m_config.hints.channels ||
-                      pkt->hints.bitspersample != m_config.hints.bitspersample ||
-                      old_bitrate              != new_bitrate;
+  bool minor_change = channels                  != m_config.hints.channels ||
+                      pkt->hints->bitspersample != m_config.hints.bitspersample ||
+                      old_bitrate               != new_bitrate;
 
-  if(pkt->hints.codec          != m_config.hints.codec ||
-     pkt->hints.samplerate     != m_config.hints.samplerate ||
+  if(pkt->hints->codec          != m_config.hints.codec ||
+     pkt->hints->samplerate     != m_config.hints.samplerate ||
      (!m_passthrough && minor_change))
   {
     printf("C : %d %d %d %d %d\n", m_config.hints.codec, m_config.hints.channels, m_config.hints.samplerate, m_config.hints.bitrate, m_config.hints.bitspersample);
-    printf("N : %d %d %d %d %d\n", pkt->hints.codec, channels, pkt->hints.samplerate, pkt->hints.bitrate, pkt->hints.bitspersample);
+    printf("N : %d %d %d %d %d\n", pkt->hints->codec, channels, pkt->hints->samplerate, pkt->hints->bitrate, pkt->hints->bitspersample);
 
 
     CloseDecoder();
     CloseAudioCodec();
 
-    m_config.hints = pkt->hints;
+    m_config.hints = *pkt->hints;
 
     m_player_ok = OpenAudioCodec();
     if(!m_player_ok)
@@ -181,26 +204,25 @@ bool OMXPlayerAudio::Decode(OMXPacket *pkt)
       if(decoded_size <=0)
         continue;
 
-      while((int) m_decoder->GetSpace() < decoded_size)
-      {
-        OMXClock::Sleep(10);
+      // woken as soon as the decoder hands back a buffer
+      while(!m_decoder->WaitForSpace(decoded_size, 10))
         if(m_flush_requested) return true;
-      }
 
       if(!m_decoder->AddPackets(decoded, decoded_size, pkt->avpkt->pts, m_pAudioCodec->GetFrameSize()))
         return false;
+
+      m_copied_bytes.fetch_add(decoded_size, std::memory_order_relaxed);
     }
   }
   else
   {
-    while((int) m_decoder->GetSpace() < pkt->avpkt->size)
-    {
-      OMXClock::Sleep(10);
+    while(!m_decoder->WaitForSpace(pkt->avpkt->size, 10))
       if(m_flush_requested) return true;
-    }
 
     if(!m_decoder->AddPackets(pkt->avpkt->data, pkt->avpkt->size, pkt->avpkt->pts, 0))
       return false;
+
+    m_copied_bytes.fetch_add(pkt->avpkt->size, std::memory_order_relaxed);
   }
 
   return true;
@@ -210,100 +232,88 @@ void OMXPlayerAudio::Process()
 {
   OMXPacket *omx_pkt = nullptr;
 
-  while(true)
+  while(!m_bAbort)
   {
-    Lock();
-    if(!m_bAbort && m_packets.empty())
-      pthread_cond_wait(&m_packet_cond, &m_lock);
-
-    if (m_bAbort)
-    {
-      UnLock();
+    // a packet which didn't go into the decoder last time round is retried
+    // before anything else is taken off the queue
+    if(!omx_pkt && !m_packets.Wait(m_bAbort))
       break;
-    }
 
-    if(m_flush && omx_pkt)
+    LockDecoder();
+    if(m_flush)
     {
-      delete omx_pkt;
+      OMXPacket::Free(omx_pkt);
       omx_pkt = nullptr;
       m_flush = false;
     }
-    else if(!omx_pkt && !m_packets.empty())
+
+    if(!omx_pkt && m_packets.Pop(omx_pkt) && !omx_pkt)
+      SubmitEOSInternal();
+
+    // a decoder which couldn't be reopened won't take it however often it's
+    // tried, otherwise give the decoder a moment before trying again rather
+    // than spinning with it locked
+    bool retry = false;
+    if(omx_pkt)
     {
-      omx_pkt = m_packets.front();
-      if (omx_pkt)
+      if(Decode(omx_pkt) || !m_player_ok)
       {
-        m_cached_size -= omx_pkt->avpkt->size;
+        OMXPacket::Free(omx_pkt);
+        omx_pkt = nullptr;
       }
       else
       {
-        assert(m_cached_size == 0);
-        SubmitEOSInternal();
+        retry = true;
       }
-      m_packets.pop_front();
-    }
-    UnLock();
-
-    LockDecoder();
-    if(m_flush && omx_pkt)
-    {
-      delete omx_pkt;
-      omx_pkt = nullptr;
-      m_flush = false;
-    }
-    else if(omx_pkt && Decode(omx_pkt))
-    {
-      delete omx_pkt;
-      omx_pkt = nullptr;
     }
     UnLockDecoder();
+
+    if(retry)
+      OMXClock::Sleep(10);
   }
 
-  if(omx_pkt)
-    delete omx_pkt;
+  OMXPacket::Free(omx_pkt);
 }
 
 void OMXPlayerAudio::Flush()
 {
   m_flush_requested = true;
-  Lock();
   LockDecoder();
   if(m_pAudioCodec)
     m_pAudioCodec->Reset();
   m_flush_requested = false;
   m_flush = true;
-  while (!m_packets.empty())
-  {
-    OMXPacket *pkt = m_packets.front();
-    m_packets.pop_front();
-    delete pkt;
-  }
+  m_packets.Clear();
   m_iCurrentPts = AV_NOPTS_VALUE;
-  m_cached_size = 0;
+  m_skip_pts = AV_NOPTS_VALUE;
   if(m_decoder)
     m_decoder->Flush();
   UnLockDecoder();
-  UnLock();
+}
+
+// Drop packets which start before pts. Cleared by Flush().
+void OMXPlayerAudio::SetStartPts(int64_t pts)
+{
+  m_skip_pts = pts - 1;
 }
 
 bool OMXPlayerAudio::AddPacket(OMXPacket *pkt)
 {
   if(m_bAbort)
   {
-    delete pkt;
+    OMXPacket::Free(pkt);
     return true;
   }
 
-  if((m_cached_size + pkt->avpkt->size) < m_config.queue_size)
-  {
-    Lock();
-    m_cached_size += pkt->avpkt->size;
-    m_packets.push_back(pkt);
-    UnLock();
-    pthread_cond_broadcast(&m_packet_cond);
+  // the byte limit stops a high bitrate stream using too much memory, the
+  // time limit stops a low bitrate one buffering minutes ahead
+  if((m_packets.GetCachedSize() + pkt->avpkt->size) < m_config.queue_size &&
+     m_packets.GetCachedDuration() < (int64_t)(m_config.queue_max_time * AV_TIME_BASE) &&
+     m_packets.Push(pkt))
     return true;
-  }
 
+  // have the decoder thread wake the main loop when it takes something
+  m_packets.WantSpace();
   return false;
 }
 
@@ -412,10 +422,7 @@ int64_t OMXPlayerAudio::GetCacheTotal()
 
 void OMXPlayerAudio::SubmitEOS()
 {
-  Lock();
-  m_packets.push_back(nullptr);
-  UnLock();
-  pthread_cond_broadcast(&m_packet_cond);
+  m_packets.Push(nullptr);
 }
 
 void OMXPlayerAudio::SubmitEOSInternal()
@@ -426,5 +433,5 @@ void OMXPlayerAudio::SubmitEOSInternal()
 
 bool OMXPlayerAudio::IsEOS()
 {
-  return m_packets.empty() && (!m_decoder || m_decoder->IsEOS());
+  return m_packets.IsEmpty() && (!m_decoder || m_decoder->IsEOS());
 }
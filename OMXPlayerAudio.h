@@ -29,8 +29,8 @@ extern "C" {
 #include "OMXStreamInfo.h"
 #include "OMXAudio.h"
 #include "OMXThread.h"
+#include "OMXPacketRing.h"
 
-#include <list>
 #include <vector>
 #include <string>
 #include <atomic>
@@ -44,9 +44,8 @@ class COMXStreamInfo;
 class OMXPlayerAudio : public OMXThread
 {
 protected:
-  std::list<OMXPacket *>    m_packets;
+  OMXPacketRing             m_packets;
   int64_t                   m_iCurrentPts        = AV_NOPTS_VALUE;
-  pthread_cond_t            m_packet_cond;
   pthread_mutex_t           m_lock_decoder;
   OMXClock                  *m_av_clock;
   std::vector<std::string>  m_codecs;
@@ -57,7 +56,9 @@ protected:
   bool                      m_hw_decode          = false;
   bool                      m_flush              = false;
   std::atomic<bool>         m_flush_requested;
-  unsigned int              m_cached_size        = 0;
+  std::atomic<uint64_t>     m_copied_bytes{0};
+  std::atomic<uint64_t>     m_discarded_bytes{0};
+  std::atomic<int64_t>      m_skip_pts;
   OMXAudioConfig            m_config;
   COMXAudioCodecOMX         *m_pAudioCodec       = nullptr;
   float                     m_CurrentVolume      = 1.0f;
@@ -75,6 +76,7 @@ public:
   ~OMXPlayerAudio() override;
 
   void Flush();
+  void SetStartPts(int64_t pts);
   int GetActiveStream();
   bool SetActiveStream(int new_index);
   int SetActiveStreamDelta(int delta);
@@ -85,7 +87,10 @@ public:
   int64_t GetCurrentPTS() { return m_iCurrentPts; }
   void SubmitEOS();
   bool IsEOS();
-  unsigned int GetCached() { return m_cached_size; }
+  unsigned int GetCached() { return m_packets.GetCachedSize(); }
+  int64_t GetCachedDuration() { return m_packets.GetCachedDuration(); }
+  uint64_t GetCopiedBytes() { return m_copied_bytes.load(std::memory_order_relaxed); }
+  uint64_t GetDiscardedBytes() { return m_discarded_bytes.load(std::memory_order_relaxed); }
   void SetVolume(float fVolume)                          { m_CurrentVolume = fVolume; if(m_decoder) m_decoder->SetVolume(fVolume); }
   float GetVolume()                                      { return m_CurrentVolume; }
   void SetMute(bool bOnOff)                              { m_mute = bOnOff; if(m_decoder) m_decoder->SetMute(bOnOff); }
@@ -59,7 +59,7 @@ OMXPlayerSubtitles::OMXPlayerSubtitles(OMXSubConfig *config,
 m_renderer(config),
 m_av_clock(clock)
 {
-  Create();
+  Create(THREAD_SUBTITLE, "subtitles");
 }
 
 
@@ -520,7 +520,7 @@ bool OMXPlayerSubtitles::GetTextLines(OMXPacket *pkt, Subtitle &sub)
   sub.stop = sub.start + static_cast<int>(pkt->avpkt->duration/1000);
 
   // skip the prefixed ssa fields (8 fields)
-  if (pkt->hints.codec == AV_CODEC_ID_SSA || pkt->hints.codec == AV_CODEC_ID_ASS)
+  if (pkt->hints->codec == AV_CODEC_ID_SSA || pkt->hints->codec == AV_CODEC_ID_ASS)
   {
     int nFieldCount = 8;
     while (nFieldCount > 0 && start < end)
@@ -596,7 +596,7 @@ bool OMXPlayerSubtitles::GetImageData(OMXPacket *pkt, Subtitle &sub)
 
 bool OMXPlayerSubtitles::GetSubData(OMXPacket *pkt, Subtitle &sub)
 {
-  sub.isImage = pkt->hints.codec == AV_CODEC_ID_DVD_SUBTITLE;
+  sub.isImage = pkt->hints->codec == AV_CODEC_ID_DVD_SUBTITLE;
 
   if(sub.isImage)
     return GetImageData(pkt, sub);
@@ -28,18 +28,19 @@
 #include "OMXPacket.h"
 #include "OMXStreamInfo.h"
 
+// upper limit on the number of packets waiting to be decoded
+#define MAX_QUEUED_PACKETS 8192
+
 class Rect;
 
 OMXPlayerVideo::OMXPlayerVideo(OMXClock *av_clock, const OMXVideoConfig &config)
 :
+m_packets(MAX_QUEUED_PACKETS),
 m_iCurrentPts(AV_NOPTS_VALUE),
-m_flush(false),
 m_flush_requested(false),
-m_cached_size(0),
 m_iVideoDelay(0),
 m_config(config)
 {
-  pthread_cond_init(&m_packet_cond, nullptr);
   pthread_mutex_init(&m_lock_decoder, nullptr);
 
   if (m_config.hints.fpsrate && m_config.hints.fpsscale)
@@ -60,7 +61,7 @@ m_config(config)
   printf("Video codec %s width %d height %d profile %d fps %f\n",
       m_decoder->GetDecoderName(), m_config.hints.width, m_config.hints.height, m_config.hints.profile, m_fps);
 
-  Create();
+  Create(THREAD_VIDEO, "video");
 }
 
 OMXPlayerVideo::~OMXPlayerVideo()
@@ -71,16 +72,12 @@ OMXPlayerVideo::~OMXPlayerVideo()
 
   if(ThreadHandle())
   {
-    Lock();
-    pthread_cond_broadcast(&m_packet_cond);
-    UnLock();
-
+    m_packets.Wake();
     StopThread();
   }
 
   delete m_decoder;
 
-  pthread_cond_destroy(&m_packet_cond);
   pthread_mutex_destroy(&m_lock_decoder);
 }
 
@@ -102,12 +99,16 @@ void OMXPlayerVideo::Reset()
   // thread reset.
   Flush();
   m_iCurrentPts       = AV_NOPTS_VALUE;
-  m_flush             = false;
   m_flush_requested   = false;
-  m_cached_size       = 0;
   m_iVideoDelay       = 0;
 }
 
+// Frames before pts are decoded but not shown. Cleared by Reset().
+void OMXPlayerVideo::SetStartPts(int64_t pts)
+{
+  m_decoder->SetDecodeOnly(pts);
+}
+
 void OMXPlayerVideo::SetAlpha(int alpha)
 {
   m_decoder->SetAlpha(alpha);
@@ -146,105 +147,63 @@ void OMXPlayerVideo::Decode(OMXPacket *pkt)
   }
 
   CLogLog(LOGINFO, "CDVDPlayerVideo::Decode dts:%lld pts:%lld cur:%lld, size:%d", pkt->avpkt->dts, pkt->avpkt->pts, m_iCurrentPts, pkt->avpkt->size);
-  m_decoder->Decode(pkt);
+
+  // COMXVideo::Decode copies the whole packet into the decoder's input buffers
+  int size = pkt->avpkt->size;
+  if(m_decoder->Decode(pkt))
+    m_copied_bytes.fetch_add(size, std::memory_order_relaxed);
 }
 
 void OMXPlayerVideo::Process()
 {
-  OMXPacket *omx_pkt = nullptr;
+  OMXPacket *omx_pkt;
 
-  while(true)
+  while(m_packets.Wait(m_bAbort))
   {
-    Lock();
-    if(!m_bAbort && m_packets.empty())
-      pthread_cond_wait(&m_packet_cond, &m_lock);
-
-    if (m_bAbort)
-    {
-      UnLock();
-      break;
-    }
-
-    if(m_flush && omx_pkt)
-    {
-      delete omx_pkt;
-      omx_pkt = nullptr;
-      m_flush = false;
-    }
-    else if(!omx_pkt && !m_packets.empty())
+    // popping under the decoder lock means Flush() can never catch a packet
+    // between the queue and the decoder
+    LockDecoder();
+    if(m_packets.Pop(omx_pkt))
     {
-      omx_pkt = m_packets.front();
-      if (omx_pkt)
-      {
-        m_cached_size -= omx_pkt->avpkt->size;
-      }
+      if(omx_pkt)
+        Decode(omx_pkt);
       else
-      {
-        assert(m_cached_size == 0);
         SubmitEOSInternal();
-      }
-      m_packets.pop_front();
-    }
-    UnLock();
 
-    LockDecoder();
-    if(m_flush && omx_pkt)
-    {
-      delete omx_pkt;
-      omx_pkt = nullptr;
-      m_flush = false;
-    }
-    else if(omx_pkt)
-    {
-      Decode(omx_pkt);
-      delete omx_pkt;
-      omx_pkt = nullptr;
+      OMXPacket::Free(omx_pkt);
     }
     UnLockDecoder();
   }
-
-  if(omx_pkt)
-    delete omx_pkt;
 }
 
 void OMXPlayerVideo::Flush()
 {
   m_flush_requested = true;
-  Lock();
   LockDecoder();
   m_flush_requested = false;
-  m_flush = true;
-  while (!m_packets.empty())
-  {
-    OMXPacket *pkt = m_packets.front();
-    m_packets.pop_front();
-    delete pkt;
-  }
+  m_packets.Clear();
   m_iCurrentPts = AV_NOPTS_VALUE;
-  m_cached_size = 0;
   m_decoder->Reset();
   UnLockDecoder();
-  UnLock();
 }
 
 bool OMXPlayerVideo::AddPacket(OMXPacket *pkt)
 {
   if(m_bAbort)
   {
-    delete pkt;
+    OMXPacket::Free(pkt);
     return true;
   }
 
-  if((m_cached_size + pkt->avpkt->size) < m_config.queue_size)
-  {
-    Lock();
-    m_cached_size += pkt->avpkt->size;
-    m_packets.push_back(pkt);
-    UnLock();
-    pthread_cond_broadcast(&m_packet_cond);
+  // the byte limit stops a high bitrate stream using too much memory, the
+  // time limit stops a low bitrate one buffering minutes ahead
+  if((m_packets.GetCachedSize() + pkt->avpkt->size) < m_config.queue_size &&
+     m_packets.GetCachedDuration() < (int64_t)(m_config.queue_max_time * AV_TIME_BASE) &&
+     m_packets.Push(pkt))
     return true;
-  }
 
+  // have the decoder thread wake the main loop when it takes something
+  m_packets.WantSpace();
   return false;
 }
 
@@ -260,10 +219,7 @@ int  OMXPlayerVideo::GetDecoderFreeSpace()
 
 void OMXPlayerVideo::SubmitEOS()
 {
-  Lock();
-  m_packets.push_back(nullptr);
-  UnLock();
-  pthread_cond_broadcast(&m_packet_cond);
+  m_packets.Push(nullptr);
 }
 
 void OMXPlayerVideo::SubmitEOSInternal()
@@ -273,7 +229,7 @@ void OMXPlayerVideo::SubmitEOSInternal()
 
 bool OMXPlayerVideo::IsEOS()
 {
-  return m_packets.empty() && m_decoder->IsEOS();
+  return m_packets.IsEmpty() && m_decoder->IsEOS();
 }
 
 double OMXPlayerVideo::NormalizeFrameduration(double frameduration)
@@ -24,8 +24,8 @@
 
 #include "OMXVideo.h"
 #include "OMXThread.h"
+#include "OMXPacketRing.h"
 
-#include <list>
 #include <atomic>
 
 class OMXClock;
@@ -34,15 +34,13 @@ class OMXPacket;
 class OMXPlayerVideo : public OMXThread
 {
 protected:
-  std::list<OMXPacket *>    m_packets;
+  OMXPacketRing             m_packets;
   int64_t                   m_iCurrentPts = 0;
-  pthread_cond_t            m_packet_cond;
   pthread_mutex_t           m_lock_decoder;
   COMXVideo                 *m_decoder = nullptr;
   float                     m_fps = 25.0f;
-  bool                      m_flush = false;
   std::atomic<bool>         m_flush_requested;
-  unsigned int              m_cached_size = 0;
+  std::atomic<uint64_t>     m_copied_bytes{0};
   int64_t                   m_iVideoDelay = 0;
   OMXVideoConfig            m_config;
 
@@ -54,11 +52,14 @@ public:
   void Reset();
 
   void Flush();
+  void SetStartPts(int64_t pts);
   bool AddPacket(OMXPacket *pkt);
   int  GetDecoderBufferSize();
   int  GetDecoderFreeSpace();
   int64_t GetCurrentPTS() { return m_iCurrentPts; }
-  unsigned int GetCached() { return m_cached_size; }
+  unsigned int GetCached() { return m_packets.GetCachedSize(); }
+  int64_t GetCachedDuration() { return m_packets.GetCachedDuration(); }
+  uint64_t GetCopiedBytes() { return m_copied_bytes.load(std::memory_order_relaxed); }
   void SubmitEOS();
   bool IsEOS();
   void SetDelay(int64_t delay) { m_iVideoDelay = delay; }
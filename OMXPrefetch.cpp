@@ -0,0 +1,106 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "OMXPrefetch.h"
+#include "OMXReaderFile.h"
+#include "OMXPacket.h"
+#include "utils/log.h"
+
+OMXPrefetch::OMXPrefetch(const std::string &filename, bool has_external_subs,
+  unsigned int max_size, int64_t max_duration)
+:
+m_filename(filename),
+m_has_external_subs(has_external_subs),
+m_max_size(max_size),
+m_max_duration(max_duration)
+{
+  Create(THREAD_DEMUX, "prefetch");
+}
+
+OMXPrefetch::~OMXPrefetch()
+{
+  if(ThreadHandle())
+    StopThread();
+
+  for(OMXPacket *pkt : m_packets)
+    OMXPacket::Free(pkt);
+
+  delete m_reader;
+}
+
+void OMXPrefetch::Process()
+{
+  CLogLog(LOGDEBUG, "OMXPrefetch: opening %s", m_filename.c_str());
+
+  try {
+    m_reader = new OMXReaderFile(m_filename, false, m_has_external_subs);
+  }
+  catch(const char *msg)
+  {
+    CLogLog(LOGWARNING, "OMXPrefetch: failed to open %s: %s", m_filename.c_str(), msg);
+    m_reader = nullptr;
+    return;
+  }
+
+  unsigned int size = 0;
+  int64_t duration[2] = {0, 0}; // video, audio
+
+  while(!m_bAbort && size < m_max_size && std::max(duration[0], duration[1]) < m_max_duration)
+  {
+    OMXPacket *pkt = m_reader->Read();
+    if(!pkt)
+      break;
+
+    size += pkt->avpkt->size;
+    if(pkt->avpkt->duration > 0)
+    {
+      if(pkt->codec_type == AVMEDIA_TYPE_VIDEO)
+        duration[0] += pkt->avpkt->duration;
+      else if(pkt->codec_type == AVMEDIA_TYPE_AUDIO)
+        duration[1] += pkt->avpkt->duration;
+    }
+
+    m_packets.push_back(pkt);
+  }
+
+  CLogLog(LOGDEBUG, "OMXPrefetch: queued %zu packets from %s", m_packets.size(), m_filename.c_str());
+}
+
+bool OMXPrefetch::Matches(const std::string &filename, bool has_external_subs)
+{
+  return m_filename == filename && m_has_external_subs == has_external_subs;
+}
+
+// Waits for the thread to finish (cutting short any reading) and hands over
+// the reader. Returns nullptr if the file couldn't be opened.
+OMXReader *OMXPrefetch::TakeReader()
+{
+  if(ThreadHandle())
+    StopThread();
+
+  OMXReader *reader = m_reader;
+  m_reader = nullptr;
+  return reader;
+}
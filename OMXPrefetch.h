@@ -0,0 +1,53 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <list>
+
+#include "OMXThread.h"
+
+class OMXReader;
+class OMXPacket;
+
+// Opens, probes and starts demuxing the next playlist item in the background
+// while the current one is finishing. Once the thread has finished the main
+// thread can take the reader and the packets which have already been read.
+class OMXPrefetch : public OMXThread
+{
+public:
+  OMXPrefetch(const std::string &filename, bool has_external_subs,
+    unsigned int max_size, int64_t max_duration);
+  ~OMXPrefetch() override;
+
+  bool Matches(const std::string &filename, bool has_external_subs);
+  OMXReader *TakeReader();
+  std::list<OMXPacket *> &Packets() { return m_packets; }
+
+private:
+  void Process() override;
+
+  std::string               m_filename;
+  bool                      m_has_external_subs;
+  unsigned int              m_max_size;
+  int64_t                   m_max_duration;
+  OMXReader                 *m_reader = nullptr;
+  std::list<OMXPacket *>    m_packets;
+};
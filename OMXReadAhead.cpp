@@ -0,0 +1,477 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <algorithm>
+
+#include "OMXReadAhead.h"
+#include "OMXPacket.h"
+#include "utils/EventLoop.h"
+#include "utils/log.h"
+
+// largest loop which is replayed from memory rather than re-read
+#define MAX_LOOP_CACHE (32 * 1024 * 1024)
+
+OMXReadAhead::OMXReadAhead(OMXReader *reader, unsigned int max_size, int64_t max_duration,
+  std::list<OMXPacket *> *preload, int64_t loop_from)
+:
+m_reader(reader),
+m_max_size(max_size),
+m_max_duration(max_duration),
+m_loop_from(loop_from)
+{
+  pthread_cond_init(&m_packet_cond, nullptr);
+  pthread_mutex_init(&m_lock_reader, nullptr);
+
+  if(preload)
+  {
+    for(OMXPacket *pkt : *preload)
+      Push(pkt);
+    preload->clear();
+  }
+
+  m_eof = m_reader->IsEof();
+
+  Create(THREAD_DEMUX, "readahead");
+}
+
+OMXReadAhead::~OMXReadAhead()
+{
+  m_bAbort = true;
+
+  if(ThreadHandle())
+  {
+    Lock();
+    pthread_cond_broadcast(&m_packet_cond);
+    UnLock();
+
+    StopThread();
+  }
+
+  while(!m_packets.empty())
+    OMXPacket::Free(Pop());
+
+  ClearLoopCache();
+
+  pthread_cond_destroy(&m_packet_cond);
+  pthread_mutex_destroy(&m_lock_reader);
+}
+
+void OMXReadAhead::LockReader()
+{
+  pthread_mutex_lock(&m_lock_reader);
+}
+
+void OMXReadAhead::UnLockReader()
+{
+  pthread_mutex_unlock(&m_lock_reader);
+}
+
+void OMXReadAhead::Process()
+{
+  while(true)
+  {
+    Lock();
+    while(!m_bAbort && (m_eof || IsFull()))
+      pthread_cond_wait(&m_packet_cond, &m_lock);
+    UnLock();
+
+    if(m_bAbort)
+      break;
+
+    // the reader lock is held for the whole read so that a seek can never
+    // land between av_read_frame and the packet being queued
+    LockReader();
+    OMXPacket *pkt = ReadPacket();
+
+    Lock();
+    bool was_empty = m_packets.empty();
+    if(pkt)
+      Push(pkt);
+    else
+      m_eof = true;
+    UnLock();
+    UnLockReader();
+
+    // the main loop only sleeps when it has run out of packets
+    if(was_empty)
+      EventLoop::Wake();
+  }
+}
+
+// call with reader lock held
+OMXPacket *OMXReadAhead::ReadPacket()
+{
+  if(m_loop_from == AV_NOPTS_VALUE)
+    return m_reader->Read();
+
+  OMXPacket *pkt;
+again:
+  if(m_replaying)
+    pkt = m_replay < m_loop_cache.size() ? OMXPacket::Ref(m_loop_cache[m_replay++]) : nullptr;
+  else
+    pkt = m_reader->Read();
+
+  if(!pkt)
+  {
+    // a pass with nothing in it would go round forever
+    if(m_pass_packets == 0 || !NextPass())
+      return nullptr;
+
+    goto again;
+  }
+
+  m_pass_packets++;
+
+  int64_t pts = pkt->avpkt->pts != AV_NOPTS_VALUE ? pkt->avpkt->pts : pkt->avpkt->dts;
+  if(pts != AV_NOPTS_VALUE)
+  {
+    int64_t end = pts + std::max(pkt->avpkt->duration, (int64_t)0);
+    if(m_pass_end == AV_NOPTS_VALUE || end > m_pass_end)
+      m_pass_end = end;
+  }
+
+  if(m_recording)
+  {
+    m_loop_cache_size += pkt->avpkt->size;
+    OMXPacket *copy = m_loop_cache_size <= MAX_LOOP_CACHE ? OMXPacket::Ref(pkt) : nullptr;
+    if(copy)
+    {
+      m_loop_cache.push_back(copy);
+    }
+    else
+    {
+      ClearLoopCache();
+      m_recording = false;
+      m_cache_overflow = true;
+    }
+  }
+
+  if(m_offset != 0)
+  {
+    // the seek back lands on the keyframe before loop_from, and anything
+    // from before it would overlap the end of the last pass. The video
+    // frames are still needed to decode what follows, but aren't shown.
+    if(pts != AV_NOPTS_VALUE && pts < m_loop_from)
+    {
+      if(pkt->codec_type != AVMEDIA_TYPE_VIDEO)
+      {
+        OMXPacket::Free(pkt);
+        goto again;
+      }
+      pkt->avpkt->flags |= AV_PKT_FLAG_DISCARD;
+    }
+
+    if(pkt->avpkt->pts != AV_NOPTS_VALUE)
+      pkt->avpkt->pts += m_offset;
+    if(pkt->avpkt->dts != AV_NOPTS_VALUE)
+      pkt->avpkt->dts += m_offset;
+  }
+
+  return pkt;
+}
+
+// Called at the end of each pass. The next starts again at m_loop_from, from
+// memory if the whole of the last pass was kept.
+// call with reader lock held
+bool OMXReadAhead::NextPass()
+{
+  if(m_pass_end == AV_NOPTS_VALUE)
+    return false;
+
+  // the first timestamp of the next pass follows on from the last of this one
+  int64_t offset = m_offset + m_pass_end - m_loop_from;
+
+  if(m_recording)
+  {
+    m_recording = false;
+    m_cache_complete = true;
+  }
+
+  if(m_cache_complete)
+  {
+    m_replaying = true;
+    m_replay = 0;
+  }
+  else
+  {
+    int64_t pts = m_loop_from;
+    m_reader->CancelResync();
+    if(m_reader->SeekTime(pts, true) != SEEK_SUCCESS)
+      return false;
+
+    ClearLoopCache();
+    m_replaying = false;
+    m_recording = !m_cache_overflow;
+  }
+
+  if(m_loop_end == AV_NOPTS_VALUE)
+  {
+    m_loop_length = m_pass_end - m_loop_from;
+    m_loop_end = m_pass_end + m_offset;
+  }
+
+  m_offset = offset;
+  m_pass_end = AV_NOPTS_VALUE;
+  m_pass_packets = 0;
+
+  CLogLog(LOGDEBUG, "OMXReadAhead: looping from %lld, offset %lld (%s)", m_loop_from, m_offset,
+    m_replaying ? "memory" : "file");
+  return true;
+}
+
+// call with reader lock held
+void OMXReadAhead::ClearLoopCache()
+{
+  for(OMXPacket *pkt : m_loop_cache)
+    OMXPacket::Free(pkt);
+  m_loop_cache.clear();
+  m_loop_cache_size = 0;
+  m_cache_complete = false;
+}
+
+// The clock keeps going up while looping. This maps it back to a time in
+// the file.
+int64_t OMXReadAhead::ToFileTime(int64_t pts)
+{
+  int64_t end = m_loop_end;
+  int64_t length = m_loop_length;
+
+  if(pts == AV_NOPTS_VALUE || end == AV_NOPTS_VALUE || length <= 0 || pts < end)
+    return pts;
+
+  return m_loop_from + (pts - end) % length;
+}
+
+// call with lock held
+bool OMXReadAhead::IsFull()
+{
+  if(m_cached_size >= m_max_size)
+    return true;
+
+  return std::max(m_cached_duration[0], m_cached_duration[1]) >= m_max_duration;
+}
+
+// call with lock held
+void OMXReadAhead::Push(OMXPacket *pkt)
+{
+  m_cached_size += pkt->avpkt->size;
+
+  if(pkt->avpkt->duration > 0)
+  {
+    if(pkt->codec_type == AVMEDIA_TYPE_VIDEO)
+      m_cached_duration[0] += pkt->avpkt->duration;
+    else if(pkt->codec_type == AVMEDIA_TYPE_AUDIO)
+      m_cached_duration[1] += pkt->avpkt->duration;
+  }
+
+  m_packets.push_back(pkt);
+}
+
+// call with lock held
+OMXPacket *OMXReadAhead::Pop()
+{
+  OMXPacket *pkt = m_packets.front();
+  m_packets.pop_front();
+
+  m_cached_size -= pkt->avpkt->size;
+
+  if(pkt->avpkt->duration > 0)
+  {
+    if(pkt->codec_type == AVMEDIA_TYPE_VIDEO)
+      m_cached_duration[0] -= pkt->avpkt->duration;
+    else if(pkt->codec_type == AVMEDIA_TYPE_AUDIO)
+      m_cached_duration[1] -= pkt->avpkt->duration;
+  }
+
+  if(m_stale > 0)
+    m_stale--;
+
+  return pkt;
+}
+
+// Appends up to max_packets packets, stopping once max_bytes have been
+// taken, to batch and returns how many there were. Never blocks.
+unsigned int OMXReadAhead::Read(std::vector<OMXPacket *> &batch, unsigned int max_packets,
+  unsigned int max_bytes)
+{
+  unsigned int count = 0;
+  unsigned int bytes = 0;
+
+  Lock();
+  while(m_stale > 0)
+    OMXPacket::Free(Pop());
+
+  while(count < max_packets && bytes < max_bytes && !m_packets.empty())
+  {
+    OMXPacket *pkt = Pop();
+    bytes += pkt->avpkt->size;
+    batch.push_back(pkt);
+    count++;
+  }
+  UnLock();
+
+  if(count > 0)
+    pthread_cond_signal(&m_packet_cond);
+
+  return count;
+}
+
+bool OMXReadAhead::IsEof()
+{
+  Lock();
+  bool eof = m_eof && m_packets.empty();
+  UnLock();
+  return eof;
+}
+
+// Drop any packets read before the last seek
+void OMXReadAhead::Flush()
+{
+  Lock();
+  while(m_stale > 0)
+    OMXPacket::Free(Pop());
+  UnLock();
+
+  pthread_cond_signal(&m_packet_cond);
+}
+
+int64_t OMXReadAhead::GetCachedDuration()
+{
+  Lock();
+  int64_t duration = std::max(m_cached_duration[0], m_cached_duration[1]);
+  UnLock();
+  return duration;
+}
+
+// call with reader lock held
+SeekResult OMXReadAhead::SeekDone(SeekResult r)
+{
+  m_reader->CancelResync();
+
+  // timestamps are back to those in the file, the same as the clock's
+  if(m_recording)
+    ClearLoopCache();
+  m_recording = m_replaying = false;
+  m_offset = 0;
+  m_pass_end = AV_NOPTS_VALUE;
+  m_pass_packets = 0;
+  m_loop_end = AV_NOPTS_VALUE;
+  m_loop_length = 0;
+
+  Lock();
+  if(r == SEEK_SUCCESS)
+    m_stale = m_packets.size();
+  m_eof = m_reader->IsEof();
+  UnLock();
+
+  pthread_cond_signal(&m_packet_cond);
+
+  return r;
+}
+
+SeekResult OMXReadAhead::SeekTime(int64_t &time, bool backwards)
+{
+  LockReader();
+  SeekResult r = SeekDone(m_reader->SeekTime(time, backwards));
+  UnLockReader();
+  return r;
+}
+
+SeekResult OMXReadAhead::SeekTimeDelta(int64_t delta_microsecs, int64_t &cur_pts)
+{
+  LockReader();
+  SeekResult r = SeekDone(m_reader->SeekTimeDelta(delta_microsecs, cur_pts));
+  UnLockReader();
+  return r;
+}
+
+SeekResult OMXReadAhead::SeekChapter(int delta, int &result_chapter, int64_t &cur_pts)
+{
+  LockReader();
+  SeekResult r = SeekDone(m_reader->SeekChapter(delta, result_chapter, cur_pts));
+  UnLockReader();
+  return r;
+}
+
+void OMXReadAhead::SetSpeed(float iSpeed)
+{
+  LockReader();
+  m_reader->SetSpeed(iSpeed);
+
+  // frames may now be skipped so what's being kept isn't the whole loop
+  if(m_recording)
+  {
+    ClearLoopCache();
+    m_recording = false;
+  }
+  UnLockReader();
+}
+
+void OMXReadAhead::SetKeyframesOnly(bool keyframes_only)
+{
+  LockReader();
+  m_reader->SetKeyframesOnly(keyframes_only);
+
+  if(m_recording)
+  {
+    ClearLoopCache();
+    m_recording = false;
+  }
+  UnLockReader();
+}
+
+// Stop demuxing the audio and subtitle streams which aren't being played.
+// A stream which is picked up again is re-read from resync_pts, unless that
+// is AV_NOPTS_VALUE, without disturbing the packets already queued.
+void OMXReadAhead::SelectStreams(int audio_index, int subtitle_index, int64_t resync_pts)
+{
+  LockReader();
+  bool enabled = m_reader->SelectStream(OMXSTREAM_AUDIO, audio_index);
+  enabled = m_reader->SelectStream(OMXSTREAM_SUBTITLE, subtitle_index) || enabled;
+
+  // a loop kept in memory doesn't have the new stream in it. The pass
+  // being replayed carries on and the next is read from the file.
+  if(enabled && (m_recording || m_cache_complete))
+  {
+    m_recording = false;
+    if(!m_replaying)
+      ClearLoopCache();
+    else
+      m_cache_complete = false;
+  }
+
+  // resync_pts is on the clock, which runs ahead of the file while looping.
+  // There's nothing to go back for if it is still in the last pass.
+  if(resync_pts != AV_NOPTS_VALUE)
+  {
+    resync_pts -= m_offset;
+    if(m_replaying || (m_offset != 0 && resync_pts < m_loop_from))
+      resync_pts = AV_NOPTS_VALUE;
+  }
+
+  if(enabled && resync_pts != AV_NOPTS_VALUE && m_reader->Resync(resync_pts) == SEEK_SUCCESS)
+  {
+    Lock();
+    m_eof = m_reader->IsEof();
+    UnLock();
+
+    pthread_cond_signal(&m_packet_cond);
+  }
+  UnLockReader();
+}
@@ -0,0 +1,105 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <atomic>
+
+#include "OMXThread.h"
+#include "OMXReader.h"
+
+class OMXPacket;
+
+// Demuxes on its own thread so that a slow av_read_frame (network stall,
+// spun-down disk, dvd seek) doesn't hold up the main loop. Packets are
+// queued until either the byte or the duration limit is reached.
+//
+// Anything which repositions the demuxer must go through this class so
+// that it is serialised with the demux thread. After a successful seek
+// the packets already in the queue are stale and are dropped by Flush().
+//
+// Packets which were read before the queue was created (see OMXPrefetch) can
+// be handed to the constructor and are queued ahead of anything else.
+//
+// Given loop_from the file is looped without ever reaching eof. Each pass
+// restarts at loop_from with timestamps carrying on from the end of the last
+// one so the decoders and clock never stop. A loop small enough to be kept
+// in memory is only read from the file once.
+class OMXReadAhead : public OMXThread
+{
+public:
+  OMXReadAhead(OMXReader *reader, unsigned int max_size, int64_t max_duration,
+    std::list<OMXPacket *> *preload = nullptr, int64_t loop_from = AV_NOPTS_VALUE);
+  ~OMXReadAhead() override;
+
+  unsigned int Read(std::vector<OMXPacket *> &batch, unsigned int max_packets, unsigned int max_bytes);
+  bool IsEof();
+  void Flush();
+
+  SeekResult SeekTime(int64_t &time, bool backwards);
+  SeekResult SeekTimeDelta(int64_t delta_microsecs, int64_t &cur_pts);
+  SeekResult SeekChapter(int delta, int &result_chapter, int64_t &cur_pts);
+  void SetSpeed(float iSpeed);
+  void SetKeyframesOnly(bool keyframes_only);
+  void SelectStreams(int audio_index, int subtitle_index, int64_t resync_pts);
+
+  unsigned int GetCached() { return m_cached_size; }
+  int64_t GetCachedDuration();
+  int64_t ToFileTime(int64_t pts);
+
+private:
+  void Process() override;
+  bool IsFull();
+  void Push(OMXPacket *pkt);
+  OMXPacket *Pop();
+  void LockReader();
+  void UnLockReader();
+  SeekResult SeekDone(SeekResult r);
+  OMXPacket *ReadPacket();
+  bool NextPass();
+  void ClearLoopCache();
+
+  OMXReader                 *m_reader;
+  std::list<OMXPacket *>    m_packets;
+  pthread_cond_t            m_packet_cond;
+  pthread_mutex_t           m_lock_reader;
+  unsigned int              m_max_size;
+  int64_t                   m_max_duration;
+  std::atomic<unsigned int> m_cached_size{0};
+  int64_t                   m_cached_duration[2] = {0, 0}; // video, audio
+  size_t                    m_stale = 0;
+  bool                      m_eof = false;
+
+  // seamless looping, only touched with the reader lock held
+  int64_t                   m_loop_from;
+  int64_t                   m_offset = 0; // added to the timestamps of this pass
+  int64_t                   m_pass_end = AV_NOPTS_VALUE;
+  unsigned int              m_pass_packets = 0;
+  std::vector<OMXPacket *>  m_loop_cache;
+  size_t                    m_loop_cache_size = 0;
+  size_t                    m_replay = 0;
+  bool                      m_recording = false;
+  bool                      m_replaying = false;
+  bool                      m_cache_complete = false;
+  bool                      m_cache_overflow = false;
+  std::atomic<int64_t>      m_loop_end{AV_NOPTS_VALUE}; // end of the first pass
+  std::atomic<int64_t>      m_loop_length{0};
+};
@@ -20,10 +20,12 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
 #include <unordered_map>
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <algorithm>
 
 extern "C" {
 #include <libavutil/avutil.h>
@@ -36,6 +38,7 @@ extern "C" {
 #include "omxplayer.h"
 #include "utils/defs.h"
 #include "utils/log.h"
+#include "utils/misc.h"
 #include "utils/simple_geometry.h"
 
 using namespace std;
@@ -45,40 +48,22 @@ std::string OMXReader::s_user_agent;
 std::string OMXReader::s_lavfdopts;
 AVDictionary *OMXReader::s_avdict = nullptr;
 
-int64_t OMXReader::timeout_start;
 int64_t OMXReader::timeout_default_duration = (int64_t)1e10; // amount of time file/network operation can stall for before timing out
-int64_t OMXReader::timeout_duration;
-
-OMXPacket::OMXPacket()
-:
-codec_type(AVMEDIA_TYPE_UNKNOWN),
-stream_type_index(-1)
-{
-  avpkt = av_packet_alloc();
-  if(!avpkt) throw "Memory Error";
-
-  avpkt->duration = AV_NOPTS_VALUE;
-  avpkt->size = 0;
-  avpkt->data = nullptr;
-  avpkt->stream_index = -1;
-}
-
-
-OMXPacket::~OMXPacket()
-{
-  av_packet_free(&avpkt);
-}
 
 void OMXReader::reset_timeout(int x)
 {
-  timeout_start = OMXClock::CurrentHostCounter();
-  timeout_duration = x * timeout_default_duration;
+  m_timeout_start = OMXClock::CurrentHostCounter();
+  m_timeout_duration = x * timeout_default_duration;
 }
 
 
-int OMXReader::interrupt_cb(void *unused)
+// each reader has its own timeout, as a playlist can have the next file
+// opening while the current one is read and batch probes open many at once
+int OMXReader::interrupt_cb(void *opaque)
 {
-  if (timeout_duration && OMXClock::CurrentHostCounter() - timeout_start > timeout_duration)
+  OMXReader *reader = static_cast<OMXReader *>(opaque);
+  int64_t duration = reader->m_timeout_duration;
+  if (duration && OMXClock::CurrentHostCounter() - reader->m_timeout_start > duration)
   {
     CLogLog(LOGERROR, "COMXPlayer::interrupt_cb - Timed out");
     return 1;
@@ -118,7 +103,7 @@ OMXReader::OMXReader()
     throw "Invalid lavfdopts";
 
   // set the interrupt callback, appeared in libavformat 53.15.0
-  m_pFormatContext->interrupt_callback = { interrupt_cb, nullptr };
+  m_pFormatContext->interrupt_callback = { interrupt_cb, this };
 
   // if format can be nonblocking, let's use that
   m_pFormatContext->flags |= AVFMT_FLAG_NONBLOCK;
@@ -135,6 +120,8 @@ OMXPacket *OMXReader::Read()
   if(m_eof)
     return nullptr;
 
+again:
+
   // assume we are not eof
   if(m_pFormatContext->pb)
     m_pFormatContext->pb->eof_reached = 0;
@@ -143,22 +130,50 @@ OMXPacket *OMXReader::Read()
   reset_timeout(1);
 
   // create packet
-  OMXPacket *omx_pkt = new OMXPacket();
-  if(av_read_frame(m_pFormatContext, omx_pkt->avpkt) < 0 || omx_pkt->avpkt->size < 0 || interrupt_cb())
+  OMXPacket *omx_pkt = OMXPacket::Alloc();
+  if(av_read_frame(m_pFormatContext, omx_pkt->avpkt) < 0 || omx_pkt->avpkt->size < 0 || interrupt_cb(this))
   {
-    delete omx_pkt;
+    OMXPacket::Free(omx_pkt);
     m_eof = true;
     return nullptr;
   }
 
-  AVStream *pStream = m_pFormatContext->streams[omx_pkt->avpkt->stream_index];
+  int index = omx_pkt->avpkt->stream_index;
+  int64_t pos = omx_pkt->avpkt->pos;
+  if((size_t)index >= m_last_pos.size())
+  {
+    m_last_pos.resize(m_pFormatContext->nb_streams, -1);
+    m_resync_pos.resize(m_pFormatContext->nb_streams, -1);
+  }
+
+  // after a resync drop anything we've already read once
+  if(m_resync_count > 0 && m_resync_pos[index] >= 0)
+  {
+    if(pos >= 0 && pos <= m_resync_pos[index])
+    {
+      OMXPacket::Free(omx_pkt);
+      goto again;
+    }
+
+    m_resync_pos[index] = -1;
+    m_resync_count--;
+  }
+
+  if(pos >= 0)
+  {
+    m_last_pos[index] = pos;
+    m_pos_known = true;
+  }
+
+  AVStream *pStream = m_pFormatContext->streams[index];
+  StreamCache &sc = GetStreamCache(pStream, omx_pkt->avpkt);
   omx_pkt->codec_type = pStream->codecpar->codec_type;
+  omx_pkt->hints = sc.hints;
 
   // let dvd nav streams through
   if(pStream->codecpar->codec_id == AV_CODEC_ID_DVD_NAV)
   {
     omx_pkt->stream_type_index = -1;
-    omx_pkt->hints.codec = AV_CODEC_ID_DVD_NAV;
     return omx_pkt;
   }
 
@@ -206,8 +221,6 @@ OMXPacket *OMXReader::Read()
     omx_pkt->avpkt->pts = AV_NOPTS_VALUE;
   }
 
-  SetHints(pStream, &omx_pkt->hints);
-
   // check if stream has passed full duration, needed for live streams
   // Do this before we convert dts and pts values
   if(omx_pkt->avpkt->dts != (int64_t)AV_NOPTS_VALUE)
@@ -226,9 +239,9 @@ OMXPacket *OMXReader::Read()
     }
   }
 
-  omx_pkt->avpkt->dts = ConvertTimestamp(omx_pkt->avpkt->dts, pStream->time_base.den, pStream->time_base.num);
-  omx_pkt->avpkt->pts = ConvertTimestamp(omx_pkt->avpkt->pts, pStream->time_base.den, pStream->time_base.num);
-  omx_pkt->avpkt->duration = AV_TIME_BASE * omx_pkt->avpkt->duration * pStream->time_base.num / pStream->time_base.den;
+  omx_pkt->avpkt->dts = ConvertTimestamp(omx_pkt->avpkt->dts, sc);
+  omx_pkt->avpkt->pts = ConvertTimestamp(omx_pkt->avpkt->pts, sc);
+  omx_pkt->avpkt->duration = omx_pkt->avpkt->duration * sc.ts_mul / sc.ts_div;
 
   return omx_pkt;
 }
@@ -399,6 +412,121 @@ bool OMXReader::SetHints(AVStream *stream, COMXStreamInfo *hints)
   return true;
 }
 
+// Only the fields which can change mid-stream and matter to the players
+bool OMXReader::HintsChanged(AVStream *stream, const COMXStreamInfo &hints)
+{
+  const AVCodecParameters *par = stream->codecpar;
+
+#if LIBAVCODEC_VERSION_MAJOR < 59
+  int channels = par->channels;
+#else
+  int channels = par->ch_layout.nb_channels;
+#endif
+
+  return hints.codec != par->codec_id ||
+         hints.extradata != par->extradata ||
+         hints.extrasize != par->extradata_size ||
+         hints.channels != channels ||
+         hints.samplerate != par->sample_rate ||
+         hints.bitrate != (int)par->bit_rate ||
+         hints.bitspersample != (par->bits_per_coded_sample ? par->bits_per_coded_sample : 16) ||
+         hints.width != par->width ||
+         hints.height != par->height ||
+         hints.profile != par->profile;
+}
+
+OMXReader::StreamCache &OMXReader::GetStreamCache(AVStream *stream, const AVPacket *pkt)
+{
+  if((size_t)stream->index >= m_stream_cache.size())
+    m_stream_cache.resize(stream->index + 1);
+
+  StreamCache &sc = m_stream_cache[stream->index];
+
+  if(!sc.hints)
+  {
+    // stream time base scaled to AV_TIME_BASE, reduced so the per packet
+    // conversion is a multiply and a divide in integers
+    int num, den;
+    av_reduce(&num, &den, (int64_t)stream->time_base.num * AV_TIME_BASE, stream->time_base.den, INT_MAX);
+    sc.ts_mul = num > 0 ? num : 1;
+    sc.ts_div = den > 0 ? den : 1;
+    sc.ts_max = INT64_MAX / sc.ts_mul;
+  }
+  else if(!(pkt->side_data_elems > 0 &&
+      (av_packet_get_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, nullptr) ||
+      av_packet_get_side_data(pkt, AV_PKT_DATA_PARAM_CHANGE, nullptr))) &&
+      !HintsChanged(stream, *sc.hints))
+  {
+    return sc;
+  }
+
+  // packets already queued keep the old hints
+  std::shared_ptr<COMXStreamInfo> hints = std::make_shared<COMXStreamInfo>();
+  SetHints(stream, hints.get());
+  sc.hints = hints;
+
+  return sc;
+}
+
+// Demux only the given stream of this type, or none if index is -1. Returns
+// true if a stream which was being discarded is now wanted.
+bool OMXReader::SelectStream(OMXStreamType type, int index)
+{
+  bool enabled = false;
+
+  for(int i = 0; i < (int)m_streams[type].size(); i++)
+  {
+    int id = m_streams[type][i].id;
+    if(id < 0)
+      continue; // external subtitles
+
+    AVStream *pStream = m_pFormatContext->streams[id];
+    if(i != index)
+    {
+      pStream->discard = AVDISCARD_ALL;
+    }
+    else if(pStream->discard == AVDISCARD_ALL)
+    {
+      pStream->discard = AVDISCARD_DEFAULT;
+      if((size_t)id < m_last_pos.size())
+        m_last_pos[id] = -1;
+      enabled = true;
+    }
+  }
+
+  return enabled;
+}
+
+// Go back to pts so that newly selected streams pick up from there, without
+// handing out the packets of the other streams a second time. Duplicates are
+// recognised by their byte position, so this needs a demuxer which sets it.
+SeekResult OMXReader::Resync(int64_t pts)
+{
+  if(!m_pos_known)
+    return SEEK_FAIL;
+
+  std::vector<int64_t> resync_pos(m_last_pos.size(), -1);
+  int count = 0;
+  for(size_t i = 0; i < m_last_pos.size(); i++)
+  {
+    if(m_pFormatContext->streams[i]->discard != AVDISCARD_ALL && m_last_pos[i] >= 0)
+    {
+      resync_pos[i] = m_last_pos[i];
+      count++;
+    }
+  }
+
+  int64_t seek_pts = pts;
+  SeekResult r = SeekTime(seek_pts, true);
+  if(r == SEEK_SUCCESS)
+  {
+    m_resync_pos.swap(resync_pos);
+    m_resync_count = count;
+  }
+
+  return r;
+}
+
 COMXStreamInfo OMXReader::GetHints(OMXStreamType type, int index)
 {
   return m_streams[type][index].hints;
@@ -418,6 +546,26 @@ int64_t OMXReader::ConvertTimestamp(int64_t pts, int den, int num)
   // do calculations in floats as they can easily overflow otherwise
   // we don't care for having a completly exact timestamp anyway
   int64_t timestamp = (double)pts * (double)num * (double)AV_TIME_BASE  / (double)den;
+
+  return SubtractStartTime(timestamp);
+}
+
+int64_t OMXReader::ConvertTimestamp(int64_t pts, const StreamCache &sc)
+{
+  if (pts == AV_NOPTS_VALUE)
+    return AV_NOPTS_VALUE;
+
+  int64_t timestamp;
+  if (pts < sc.ts_max && pts > -sc.ts_max)
+    timestamp = pts * sc.ts_mul / sc.ts_div;
+  else
+    timestamp = av_rescale(pts, sc.ts_mul, sc.ts_div);
+
+  return SubtractStartTime(timestamp);
+}
+
+int64_t OMXReader::SubtractStartTime(int64_t timestamp)
+{
   int64_t starttime = 0;
 
   if (m_pFormatContext->start_time != AV_NOPTS_VALUE)
@@ -439,7 +587,19 @@ void OMXReader::SetSpeed(float iSpeed)
     av_read_play(m_pFormatContext);
 
   m_speed = iSpeed;
+  UpdateDiscard();
+}
 
+// For trick play, have the demuxer drop every video packet but the
+// keyframes whatever the speed
+void OMXReader::SetKeyframesOnly(bool keyframes_only)
+{
+  m_keyframes_only = keyframes_only;
+  UpdateDiscard();
+}
+
+void OMXReader::UpdateDiscard()
+{
   AVDiscard discard = AVDISCARD_NONE;
   if(m_speed > 4.0)
     discard = AVDISCARD_NONKEY;
@@ -449,9 +609,16 @@ void OMXReader::SetSpeed(float iSpeed)
     discard = AVDISCARD_NONKEY;
 
   for(unsigned int i = 0; i < m_pFormatContext->nb_streams; i++)
-    if(m_pFormatContext->streams[i]
-        && m_pFormatContext->streams[i]->discard != AVDISCARD_ALL)
-      m_pFormatContext->streams[i]->discard = discard;
+  {
+    AVStream *st = m_pFormatContext->streams[i];
+    if(!st || st->discard == AVDISCARD_ALL)
+      continue;
+
+    if(m_keyframes_only && st->codecpar->codec_type == AVMEDIA_TYPE_VIDEO)
+      st->discard = AVDISCARD_NONKEY;
+    else
+      st->discard = discard;
+  }
 }
 
 int OMXReader::GetStreamLengthSeconds()
@@ -595,40 +762,67 @@ void OMXReader::info_dump(const std::string &filename)
   }
 }
 
-bool OMXReader::SetAvDict(const char *ad)
+// One line of JSON, for BatchProbe
+void OMXReader::json_dump(const std::string &filename, std::string &out)
 {
-  return av_dict_parse_string(&s_avdict, ad, ":", ",", 0) >= 0;
-}
+  char buf[256];
 
-void OMXReader::GetChapterMetaData(std::vector<std::string>& chapter_list)
-{
-  chapter_list.clear();
-
-  if (!m_pFormatContext)
-    return;
+  snprintf(buf, sizeof(buf), "\",\"format\":\"%s\",\"duration\":%.3f,\"streams\":[",
+      m_pFormatContext->iformat->name,
+      m_pFormatContext->duration != AV_NOPTS_VALUE ? (double)m_pFormatContext->duration / AV_TIME_BASE : 0.0);
+  out = "{\"file\":\"" + json_escape(filename) + buf;
 
-  for (unsigned int i = 0; i < m_pFormatContext->nb_chapters; i++)
+  bool first = true;
+  for(const auto &stream : m_streams[OMXSTREAM_VIDEO])
   {
-    AVChapter *ch = m_pFormatContext->chapters[i];
-
-    int64_t start_ms = av_rescale_q(
-      ch->start,
-      ch->time_base,
-      AVRational{1,1000});
+    snprintf(buf, sizeof(buf), "%s{\"type\":\"video\",\"id\":%d,\"codec\":\"",
+        first ? "" : ",", stream.hex_id);
+    out += buf;
+    out += json_escape(stream.codec_name);
+    snprintf(buf, sizeof(buf), "\",\"fps\":%.3f,\"width\":%d,\"height\":%d,\"aspect\":%.3f}",
+        stream.hints.fpsscale ? (float)stream.hints.fpsrate / (float)stream.hints.fpsscale : 0.0f,
+        stream.hints.width, stream.hints.height,
+        stream.hints.aspect);
+    out += buf;
+    first = false;
+  }
+  for(const auto &stream : m_streams[OMXSTREAM_AUDIO])
+  {
+    snprintf(buf, sizeof(buf), "%s{\"type\":\"audio\",\"id\":%d,\"codec\":\"",
+        first ? "" : ",", stream.hex_id);
+    out += buf;
+    out += json_escape(stream.codec_name) + "\",\"language\":\"" + json_escape(stream.language);
+    snprintf(buf, sizeof(buf), "\",\"channels\":%d,\"samplerate\":%d,\"bitspersample\":%d}",
+        stream.hints.channels,
+        stream.hints.samplerate,
+        stream.hints.bitspersample);
+    out += buf;
+    first = false;
+  }
+  for(const auto &stream : m_streams[OMXSTREAM_SUBTITLE])
+  {
+    snprintf(buf, sizeof(buf), "%s{\"type\":\"subtitle\",\"id\":%d,\"codec\":\"",
+        first ? "" : ",", stream.hex_id);
+    out += buf;
+    out += json_escape(stream.codec_name) + "\",\"language\":\"" + json_escape(stream.language) + "\"}";
+    first = false;
+  }
 
-    const AVDictionaryEntry *title =
-      av_dict_get(ch->metadata, "title", NULL, 0);
+  snprintf(buf, sizeof(buf), "],\"chapters\":%u}", m_pFormatContext->nb_chapters);
+  out += buf;
+}
 
-    char buf[256];
+bool OMXReader::SetAvDict(const char *ad)
+{
+  return av_dict_parse_string(&s_avdict, ad, ":", ",", 0) >= 0;
+}
 
-    snprintf(buf,
-             sizeof(buf),
-             "%02lld:%02lld:%02lld %s",
-             start_ms / 3600000,
-             (start_ms / 60000) % 60,
-             (start_ms / 1000) % 60,
-             title ? title->value : "");
+// the chapter pts is in, or -1 if it's before the first one
+int OMXReader::GetChapter(int64_t pts)
+{
+  if(pts == AV_NOPTS_VALUE)
+    return -1;
 
-    chapter_list.push_back(buf);
-  }
+  auto it = std::upper_bound(m_chapters.begin(), m_chapters.end(), pts);
+  return (it - m_chapters.begin()) - 1;
 }
@@ -27,6 +27,8 @@
 #include <stdint.h>
 #include <vector>
 #include <string>
+#include <memory>
+#include <atomic>
 #include <unordered_map>
 
 class Dimension;
@@ -34,9 +36,11 @@ class Dimension;
 #define MAX_VIDEO_STREAMS 1
 
 class OMXPacket;
+class PipeBuffer;
 struct AVFormatContext;
 struct AVDictionary;
 struct AVStream;
+struct AVPacket;
 
 enum OMXStreamType
 {
@@ -72,6 +76,7 @@ public:
   inline int GetWidth() { return m_width; }
   inline int GetHeight() { return m_height; }
   void SetSpeed(float iSpeed);
+  void SetKeyframesOnly(bool keyframes_only);
   virtual SeekResult SeekChapter(int delta, int &result_chapter, int64_t &cur_pts) = 0;
   int GetStreamLengthSeconds();
   int64_t GetStreamLengthMicro();
@@ -80,6 +85,7 @@ public:
   std::string GetStreamLanguage(OMXStreamType type, unsigned int index);
   int GetStreamByLanguage(OMXStreamType type, const std::string &lang);
   virtual bool CanSeek() = 0;
+  virtual PipeBuffer *GetPipeBuffer() { return nullptr; }
   bool FindDVDSubs(Dimension &d, float &aspect, uint32_t **palette, uint32_t *buf);
   static void SetCookie(const char *c);
   inline static void SetUserAgent(const char *ua) { s_user_agent.assign(ua); }
@@ -87,7 +93,12 @@ public:
   static bool SetAvDict(const char *ad);
   static void SetDefaultTimeout(float timeout);
   void info_dump(const std::string &filename);
-  void GetChapterMetaData(std::vector<std::string>& chapter_list);
+  void json_dump(const std::string &filename, std::string &out);
+  const std::vector<std::string> &GetChapterMetaData() { return m_chapter_list; }
+  int GetChapter(int64_t pts);
+  bool SelectStream(OMXStreamType type, int index);
+  SeekResult Resync(int64_t pts);
+  void CancelResync() { m_resync_count = 0; }
 
 protected:
   class OMXStream
@@ -104,33 +115,56 @@ protected:
     COMXStreamInfo hints;
   };
 
+  // worked out once per demuxer stream rather than for every packet
+  class StreamCache
+  {
+  public:
+    std::shared_ptr<const COMXStreamInfo> hints;
+    int64_t        ts_mul      = 1;  // time base in AV_TIME_BASE units, reduced
+    int64_t        ts_div      = 1;
+    int64_t        ts_max      = INT64_MAX; // beyond this ts * ts_mul overflows
+  };
+
   bool                      m_bMatroska       = false;
   bool                      m_bAVI            = false;
   AVFormatContext           *m_pFormatContext = nullptr;
   bool                      m_eof             = false;
   std::vector<OMXStream>    m_streams[OMXSTREAM_END];
   float                     m_speed           = DVD_PLAYSPEED_NORMAL;
+  bool                      m_keyframes_only  = false;
   double                    m_aspect          = 0.0f;
   int                       m_width           = 0;
   int                       m_height          = 0;
   int                       m_dvd_subs        = -1;
   bool                      m_dvd_subs_need_init = false;
   std::unordered_map<int, int>   m_steam_map;
+  std::vector<StreamCache>  m_stream_cache;
+  std::vector<int64_t>      m_last_pos;       // per demuxer stream
+  std::vector<int64_t>      m_resync_pos;
+  int                       m_resync_count    = 0;
+  bool                      m_pos_known       = false;
+  std::vector<int64_t>      m_chapters;       // start times, sorted
+  std::vector<std::string>  m_chapter_list;   // "hh:mm:ss title" for each
   static std::string        s_cookie;
   static std::string        s_user_agent;
   static std::string        s_lavfdopts;
   static AVDictionary       *s_avdict;
-  static int64_t timeout_start;
+  std::atomic<int64_t>      m_timeout_start{0};
+  std::atomic<int64_t>      m_timeout_duration{0};
   static int64_t timeout_default_duration;
-  static int64_t timeout_duration;
 
   std::string GetStreamCodecName(AVStream *stream);
   virtual int AddStream(int id, const char* lang = nullptr);
   void PopulateStream(int id, const char *lang, OMXStream *this_stream);
   double SelectAspect(AVStream* st, bool& forced);
   int64_t ConvertTimestamp(int64_t pts, int den, int num);
-  static int interrupt_cb(void *unused = nullptr);
-  static void reset_timeout(int x);
+  int64_t ConvertTimestamp(int64_t pts, const StreamCache &sc);
+  int64_t SubtractStartTime(int64_t timestamp);
+  StreamCache &GetStreamCache(AVStream *stream, const AVPacket *pkt);
+  bool HintsChanged(AVStream *stream, const COMXStreamInfo &hints);
+  void UpdateDiscard();
+  static int interrupt_cb(void *opaque);
+  void reset_timeout(int x);
   bool SetHints(AVStream *stream, COMXStreamInfo *hints);
   virtual uint32_t *getPalette(OMXStream *st, uint32_t *palette) = 0;
 };
@@ -103,7 +103,7 @@ again:
     return nullptr;
 
   // check for dvd_nav_packets
-  if(pkt->hints.codec == AV_CODEC_ID_DVD_NAV)
+  if(pkt->hints->codec == AV_CODEC_ID_DVD_NAV)
   {
     pci_t pci_pack;
 
@@ -118,7 +118,7 @@ again:
 
     m_prev_pack_end = pci_pack.pci_gi.vobu_e_ptm;
 
-    delete pkt;
+    OMXPacket::Free(pkt);
     goto again;
   }
 
@@ -282,7 +282,7 @@ int64_t OMXReaderDvd::dvd_seek(void *h, int64_t new_pos, int whence)
 int OMXReaderDvd::DvdRead(uint8_t *lpBuf, int blocks_to_read)
 {
   reset_timeout(1);
-  if(interrupt_cb())
+  if(interrupt_cb(this))
     return -1;
 
   if(m_pos + blocks_to_read > m_current_track.parts[m_current_part].blocks) {
@@ -323,7 +323,7 @@ uint32_t *OMXReaderDvd::getPalette(OMXStream *st, uint32_t *palette)
 int64_t OMXReaderDvd::DvdSeek(int new_pos, int whence)
 {
   reset_timeout(1);
-  if(interrupt_cb())
+  if(interrupt_cb(this))
     return -1;
 
   switch(whence)
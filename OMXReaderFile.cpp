@@ -20,6 +20,8 @@
  */
 
 #include <string>
+#include <vector>
+#include <algorithm>
 
 extern "C" {
 #include <libavutil/avutil.h>
@@ -28,11 +30,15 @@ extern "C" {
 
 #include "OMXReader.h"
 #include "OMXReaderFile.h"
+#include "OMXPacket.h"
+#include "ProbeCache.h"
 #include "utils/misc.h"
 #include "utils/log.h"
 
 using namespace std;
 
+bool OMXReaderFile::s_accurate_seek = false;
+
 OMXReaderFile::OMXReaderFile(string &filename, bool live, bool has_external_subs)
 {
   AVDictionary *d = nullptr;
@@ -51,8 +57,9 @@ OMXReaderFile::OMXReaderFile(string &filename, bool live, bool has_external_subs
       filename.erase(idx);
 
     // Enable seeking if http, ftp
-    if(!live && (filename.substr(0,7) == "http://" || filename.substr(0,8) == "https://" ||
-        filename.substr(0,6) == "ftp://" || filename.substr(0,7) == "sftp://"))
+    bool seekable = !live && (filename.substr(0,7) == "http://" || filename.substr(0,8) == "https://" ||
+        filename.substr(0,6) == "ftp://" || filename.substr(0,7) == "sftp://");
+    if(seekable)
     {
        av_dict_set(&d, "seekable", "1", 0);
     }
@@ -63,44 +70,143 @@ OMXReaderFile::OMXReaderFile(string &filename, bool live, bool has_external_subs
 
     if(!s_user_agent.empty())
        av_dict_set(&d, "user_agent", s_user_agent.c_str(), 0);
+
+    // read the stream through a cache so stalls and short seeks
+    // don't go back to the server
+    if(seekable && NetCache::Enabled())
+    {
+      CLogLog(LOGDEBUG, "COMXPlayer::OpenFile - using network cache");
+      m_net_cache.reset(new NetCache(filename, &d, m_pFormatContext->interrupt_callback));
+      m_pFormatContext->pb = m_net_cache->GetContext();
+    }
+  }
+  else if(IsPipe(filename))
+  {
+    if(PipeBuffer::Enabled())
+    {
+      m_pipe.reset(new PipeBuffer(filename, m_pFormatContext->interrupt_callback));
+      m_pFormatContext->pb = m_pipe->GetContext();
+      CLogLog(LOGDEBUG, "COMXPlayer::OpenFile - using pipe buffer");
+    }
+  }
+  else if(!live && MmapIO::Enabled())
+  {
+    // anything which can't be mapped goes through ffmpeg as usual
+    try
+    {
+      m_mmap.reset(new MmapIO(filename));
+      m_pFormatContext->pb = m_mmap->GetContext();
+      CLogLog(LOGDEBUG, "COMXPlayer::OpenFile - using mmap");
+    }
+    catch(const char *msg)
+    {
+      CLogLog(LOGWARNING, "COMXPlayer::OpenFile - %s", msg);
+    }
   }
 
   CLogLog(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input %s", filename.c_str());
 
+  int64_t open_start = OMXClock::GetAbsoluteClock();
+
   int result = avformat_open_input(&m_pFormatContext, filename.c_str(), nullptr, &d);
   av_dict_free(&d);
   if(result < 0)
     throw "avformat_open_input failed";
 
-  if(live)
+  // from here on the demuxer may be reading from one of our AVIOContexts,
+  // so if anything fails it has to be closed before they're destroyed
+  try
   {
-     CLogLog(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input disabled SEEKING");
-     m_pFormatContext->pb->seekable = 0;
-  }
+    if(live)
+    {
+       CLogLog(LOGDEBUG, "COMXPlayer::OpenFile - avformat_open_input disabled SEEKING");
+       m_pFormatContext->pb->seekable = 0;
+    }
+
+    m_bMatroska = strncmp(m_pFormatContext->iformat->name, "matroska", 8) == 0; // for "matroska.webm"
+    m_bAVI = strcmp(m_pFormatContext->iformat->name, "avi") == 0;
+
+    // analyse very short to speed up mjpeg playback start
+    if(strcmp(m_pFormatContext->iformat->name, "mjpeg") == 0)
+      m_pFormatContext->max_analyze_duration = 500000;
+
+    if(m_bMatroska)
+      m_pFormatContext->max_analyze_duration = 0;
+
+    if (live)
+      m_pFormatContext->flags |= AVFMT_FLAG_NOBUFFER;
+
+    // a file we've seen before only needs a short probe
+    bool warm = !live && ProbeCache::Load(filename, m_pFormatContext);
+    if(!warm)
+    {
+      if(avformat_find_stream_info(m_pFormatContext, nullptr) < 0)
+        throw "avformat_find_stream_info failed";
+
+      if(!live)
+        ProbeCache::Save(filename, m_pFormatContext);
+    }
+
+    CLogLog(LOGINFO, "COMXPlayer::OpenFile - %s open took %lldms", warm ? "warm" : "cold",
+        (OMXClock::GetAbsoluteClock() - open_start) / 1000);
+
+    // fill in rest of metadata
+    GetStreams();
+    GetChapters();
 
-  m_bMatroska = strncmp(m_pFormatContext->iformat->name, "matroska", 8) == 0; // for "matroska.webm"
-  m_bAVI = strcmp(m_pFormatContext->iformat->name, "avi") == 0;
+    // add metsdata for external subtitles
+    if(has_external_subs)
+      AddExternalSubs();
 
-  // analyse very short to speed up mjpeg playback start
-  if(strcmp(m_pFormatContext->iformat->name, "mjpeg") == 0)
-    m_pFormatContext->max_analyze_duration = 500000;
+    // raw transport and program streams have no index, so av_seek_frame has to
+    // bisect the file. Remember where the keyframes are instead.
+    if(!live && CanSeek() && m_streams[OMXSTREAM_VIDEO].size() > 0 &&
+        (strcmp(m_pFormatContext->iformat->name, "mpegts") == 0 ||
+        strcmp(m_pFormatContext->iformat->name, "mpeg") == 0))
+    {
+      m_filename = filename;
+      m_key_index = new KeyframeIndex();
+      m_key_index->Load(m_filename);
+
+      if(KeyframeIndex::BackgroundScan())
+        m_key_scanner = new KeyframeScanner(m_filename, m_key_index);
+    }
+  }
+  catch(...)
+  {
+    delete m_key_scanner;
+    delete m_key_index;
+    avformat_close_input(&m_pFormatContext);
+    throw;
+  }
+}
 
-  if(m_bMatroska)
-    m_pFormatContext->max_analyze_duration = 0;
+OMXReaderFile::~OMXReaderFile()
+{
+  // our AVIOContexts must outlive the demuxer reading from them
+  if(m_net_cache || m_mmap || m_pipe)
+    avformat_close_input(&m_pFormatContext);
 
-  if (live)
-    m_pFormatContext->flags |= AVFMT_FLAG_NOBUFFER;
+  if(m_key_index)
+  {
+    delete m_key_scanner;
+    m_key_index->Save(m_filename);
+    delete m_key_index;
+  }
+}
 
-  if(avformat_find_stream_info(m_pFormatContext, nullptr) < 0)
-    throw "avformat_find_stream_info failed";
+OMXPacket *OMXReaderFile::Read()
+{
+  OMXPacket *pkt = OMXReader::Read();
 
-  // fill in rest of metadata
-  GetStreams();
-  GetChapters();
+  if(m_key_index && pkt && pkt->codec_type == AVMEDIA_TYPE_VIDEO &&
+      (pkt->avpkt->flags & AV_PKT_FLAG_KEY))
+  {
+    m_key_index->Add(pkt->avpkt->pts != AV_NOPTS_VALUE ? pkt->avpkt->pts : pkt->avpkt->dts,
+        pkt->avpkt->pos);
+  }
 
-  // add metsdata for external subtitles
-  if(has_external_subs)
-    AddExternalSubs();
+  return pkt;
 }
 
 enum SeekResult OMXReaderFile::SeekTimeDelta(int64_t delta, int64_t &cur_pts)
@@ -121,13 +227,20 @@ enum SeekResult OMXReaderFile::SeekTime(int64_t &seek_pts, bool backwards)
   if(!CanSeek())
     return SEEK_FAIL;
 
+  backwards = backwards || s_accurate_seek;
   int flags = backwards ? AVSEEK_FLAG_BACKWARD : 0;
   int64_t seek_value = seek_pts;
   if (m_pFormatContext->start_time != (int64_t)AV_NOPTS_VALUE)
     seek_value += m_pFormatContext->start_time;
 
   reset_timeout(1);
-  bool success = av_seek_frame(m_pFormatContext, -1, seek_value, flags) >= 0;
+
+  int64_t pos;
+  bool success;
+  if(m_key_index && m_key_index->Find(seek_pts, backwards, pos))
+    success = av_seek_frame(m_pFormatContext, -1, pos, AVSEEK_FLAG_BYTE) >= 0;
+  else
+    success = av_seek_frame(m_pFormatContext, -1, seek_value, flags) >= 0;
 
   // demuxer will return failure, if you seek to eof
   m_eof = !success;
@@ -151,21 +264,16 @@ SeekResult OMXReaderFile::SeekChapter(int delta, int &result_chapter, int64_t &c
   if(cur_pts == AV_NOPTS_VALUE) return SEEK_FAIL;
 
   // We have no chapters to seek to
-  if(m_chapter_count == 0)
+  if(m_chapters.empty())
     return SEEK_NO_CHAPTERS;
 
-  // Find current chapter
-  int current_chapter = 0;
-  for(; current_chapter < m_chapter_count - 1; current_chapter++)
-    if(cur_pts >=   m_chapters[current_chapter] && cur_pts <  m_chapters[current_chapter+1])
-      break;
-
   // turn delta into absolute value and check in within range
-  int new_chapter = current_chapter + delta;
-  if(new_chapter < 0 || new_chapter >= m_chapter_count)
+  int new_chapter = GetChapter(cur_pts) + delta;
+  if(new_chapter < 0 || new_chapter >= (int)m_chapters.size())
     return SEEK_OUT_OF_BOUNDS;
 
-  SeekResult r = SeekTime(m_chapters[new_chapter], delta < 0);
+  int64_t seek_pts = m_chapters[new_chapter];
+  SeekResult r = SeekTime(seek_pts, delta < 0);
   if(r == SEEK_SUCCESS)
   {
     // update time
@@ -180,17 +288,40 @@ SeekResult OMXReaderFile::SeekChapter(int delta, int &result_chapter, int64_t &c
 
 void OMXReaderFile::GetChapters()
 {
-  m_chapter_count = (m_pFormatContext->nb_chapters > MAX_OMX_CHAPTERS) ? MAX_OMX_CHAPTERS : m_pFormatContext->nb_chapters;
-  for(int i = 0; i < m_chapter_count; i++)
+  std::vector<std::pair<int64_t, const char *>> chapters;
+  chapters.reserve(m_pFormatContext->nb_chapters);
+
+  for(unsigned int i = 0; i < m_pFormatContext->nb_chapters; i++)
   {
     const AVChapter *chapter = m_pFormatContext->chapters[i];
     if(!chapter)
-    {
-      m_chapter_count = i;
       break;
-    }
 
-    m_chapters[i] = ConvertTimestamp(chapter->start, chapter->time_base.den, chapter->time_base.num);
+    int64_t start = ConvertTimestamp(chapter->start, chapter->time_base.den, chapter->time_base.num);
+    if(start == AV_NOPTS_VALUE)
+      continue;
+
+    const AVDictionaryEntry *title = av_dict_get(chapter->metadata, "title", nullptr, 0);
+    chapters.emplace_back(start, title ? title->value : "");
+  }
+
+  // containers don't promise to list chapters in order
+  std::stable_sort(chapters.begin(), chapters.end(),
+      [](const auto &a, const auto &b) { return a.first < b.first; });
+
+  m_chapters.reserve(chapters.size());
+  m_chapter_list.reserve(chapters.size());
+
+  for(const auto &ch : chapters)
+  {
+    int64_t secs = std::max(ch.first, (int64_t)0) / AV_TIME_BASE;
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02lld:%02lld:%02lld ",
+        (long long)(secs / 3600), (long long)(secs / 60 % 60), (long long)(secs % 60));
+
+    m_chapters.push_back(ch.first);
+    m_chapter_list.push_back(buf + std::string(ch.second));
   }
 }
 
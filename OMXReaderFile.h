@@ -21,22 +21,32 @@
  */
 
 #include "OMXReader.h"
-#include "OMXReaderFile.h"
+#include "KeyframeIndex.h"
+#include "NetCache.h"
+#include "MmapIO.h"
+#include "PipeBuffer.h"
 
 #include <string>
+#include <memory>
 #include <stdint.h>
 
-#define MAX_OMX_CHAPTERS 64
-
 class OMXReaderFile : public OMXReader
 {
 public:
   OMXReaderFile(std::string &filename, bool live, bool has_extern);
+  ~OMXReaderFile() override;
+
+  OMXPacket *Read() override;
 
   bool CanSeek() override;
   SeekResult SeekChapter(int delta, int &result_chapter, int64_t &cur_pts) override;
   enum SeekResult SeekTime(int64_t &time, bool backwards) override;
   enum SeekResult SeekTimeDelta(int64_t delta, int64_t &cur_pts) override;
+  PipeBuffer *GetPipeBuffer() override { return m_pipe.get(); }
+
+  // always seek to the keyframe before the target so that the frames up to
+  // it can be decoded and dropped
+  static void SetAccurateSeek(bool accurate) { s_accurate_seek = accurate; }
 
 protected:
   void GetStreams();
@@ -44,6 +54,19 @@ protected:
   uint32_t *getPalette(OMXStream *st, uint32_t *palette) override;
   void AddExternalSubs();
 
-  int64_t m_chapters[MAX_OMX_CHAPTERS];
-  int m_chapter_count = 0;
+  // only set for containers which can't seek quickly by themselves
+  KeyframeIndex *m_key_index = nullptr;
+  KeyframeScanner *m_key_scanner = nullptr;
+  std::string m_filename;
+
+  // only set for network streams
+  std::unique_ptr<NetCache> m_net_cache;
+
+  // only set for local files with --mmap
+  std::unique_ptr<MmapIO> m_mmap;
+
+  // only set for pipes and fifos with --pipe-buffer
+  std::unique_ptr<PipeBuffer> m_pipe;
+
+  static bool s_accurate_seek;
 };
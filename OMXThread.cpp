@@ -35,6 +35,8 @@ OMXThread::OMXThread()
   m_thread    = 0;
   m_bAbort     = false;
   m_running   = false;
+  m_role      = THREAD_DEFAULT;
+  m_name      = nullptr;
 }
 
 OMXThread::~OMXThread()
@@ -63,13 +65,15 @@ bool OMXThread::StopThread()
   return true;
 }
 
-void OMXThread::Create()
+void OMXThread::Create(ThreadRole role, const char *name)
 {
   if(m_running)
     throw CLASSNAME " - Thread already running";
 
   m_bAbort    = false;
   m_running = true;
+  m_role = role;
+  m_name = name;
 
   pthread_create(&m_thread, &m_tattr, &OMXThread::Run, this);
 
@@ -89,6 +93,11 @@ pthread_t OMXThread::ThreadHandle()
 void *OMXThread::Run(void *arg)
 {
   OMXThread *thread = static_cast<OMXThread *>(arg);
+  // so that top -H and friends can tell the threads apart
+  if(thread->m_name)
+    pthread_setname_np(pthread_self(), thread->m_name);
+
+  ThreadSched::Apply(thread->m_role);
   thread->Process();
 
   CLogLog(LOGDEBUG, "%s::%s - Exited thread with  id %d", CLASSNAME, __func__, (int)thread->ThreadHandle());
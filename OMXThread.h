@@ -24,6 +24,7 @@
 #include <atomic>
 
 #include "utils/NoMoveCopy.h"
+#include "utils/ThreadSched.h"
 
 class OMXThread : NoMoveCopy
 {
@@ -33,12 +34,14 @@ protected:
   pthread_t           m_thread;
   volatile bool       m_running;
   std::atomic<bool>   m_bAbort;
+  ThreadRole          m_role;
+  const char          *m_name;
 private:
   static void *Run(void *arg);
 public:
   OMXThread();
   virtual ~OMXThread();
-  void Create();
+  void Create(ThreadRole role = THREAD_DEFAULT, const char *name = nullptr);
   virtual void Process() = 0;
   bool Running();
   pthread_t ThreadHandle();
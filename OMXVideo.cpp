@@ -669,8 +669,15 @@ bool COMXVideo::Decode(OMXPacket *pkt)
   if (pkt->avpkt->data && pkt->avpkt->size > 0)
   {
     OMX_U32 nFlags = 0;
+    int64_t pts = pkt->avpkt->pts != AV_NOPTS_VALUE ? pkt->avpkt->pts : pkt->avpkt->dts;
 
-    if(m_setStartTime)
+    // the clock starts from the first frame which is actually shown
+    if((m_decode_only_pts != AV_NOPTS_VALUE && pts != AV_NOPTS_VALUE && pts < m_decode_only_pts) ||
+        (pkt->avpkt->flags & AV_PKT_FLAG_DISCARD))
+    {
+      nFlags |= OMX_BUFFERFLAG_DECODEONLY;
+    }
+    else if(m_setStartTime)
     {
       nFlags |= OMX_BUFFERFLAG_STARTTIME;
       CLogLog(LOGDEBUG, "OMXVideo::Decode VDec : setStartTime %f", (pkt->avpkt->pts == AV_NOPTS_VALUE ? 0.0 : (double)pkt->avpkt->pts) / AV_TIME_BASE);
@@ -743,12 +750,21 @@ void COMXVideo::Reset(void)
   CSingleLock lock (m_critSection);
 
   m_setStartTime      = true;
+  m_decode_only_pts   = AV_NOPTS_VALUE;
   m_omx_decoder.FlushInput();
   if(m_deinterlace || m_config.anaglyph)
     m_omx_image_fx.FlushInput();
   m_omx_render.ResetEos();
 }
 
+// Frames before pts are decoded, as later frames may depend on them, but
+// aren't displayed. Cleared by Reset().
+void COMXVideo::SetDecodeOnly(int64_t pts)
+{
+  CSingleLock lock (m_critSection);
+  m_decode_only_pts = pts;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////
 void COMXVideo::SetVideoRect(const Rect& SrcRect, const Rect& DestRect)
 {
@@ -60,6 +60,8 @@ public:
   int display = 0;
   int layer = 1;
   unsigned int queue_size = 10 * 1024 * 1024;
+  float queue_min_time = 0.0f;
+  float queue_max_time = 10.0f;
   float fifo_size = (float)80*1024*60 / (1024*1024);
 };
 
@@ -72,6 +74,7 @@ public:
   unsigned int GetFreeSpace();
   bool  Decode(OMXPacket *pkt);
   void Reset(void);
+  void SetDecodeOnly(int64_t pts);
   const char *GetDecoderName() { return m_video_codec_name; }
   void SetVideoRect(const Rect& SrcRect, const Rect& DestRect);
   void SetVideoRect(int aspectMode);
@@ -104,6 +107,7 @@ protected:
   COMXCoreTunel     m_omx_tunnel_image_fx;
 
   bool              m_setStartTime = false;
+  int64_t           m_decode_only_pts = AV_NOPTS_VALUE; // frames before this aren't shown
 
   const char        *m_video_codec_name;
 
@@ -0,0 +1,234 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <algorithm>
+
+extern "C" {
+#include <libavutil/avutil.h>
+#include <libavutil/error.h>
+#include <libavutil/mem.h>
+}
+
+#include "PipeBuffer.h"
+#include "utils/log.h"
+
+#define AVIO_BUFFER_SIZE        32768
+#define MAX_READ_SIZE           65536
+#define MIN_BUFFER_SIZE         (2 * MAX_READ_SIZE)
+
+size_t PipeBuffer::s_size = 4 * 1024 * 1024;
+
+PipeBuffer::PipeBuffer(const std::string &filename, const AVIOInterruptCB &interrupt)
+:
+m_interrupt(interrupt),
+m_size(std::max(s_size, (size_t)MIN_BUFFER_SIZE))
+{
+  // same naming as ffmpeg's pipe protocol
+  if(filename.compare(0, 5, "pipe:") == 0)
+  {
+    m_fd = filename.size() > 5 ? atoi(filename.c_str() + 5) : STDIN_FILENO;
+  }
+  else
+  {
+    m_fd = open(filename.c_str(), O_RDONLY);
+    m_close_fd = true;
+  }
+
+  if(m_fd < 0)
+    throw "PipeBuffer: can't open input";
+
+  m_buffer = (uint8_t *)malloc(m_size);
+  unsigned char *avio_buffer = (unsigned char*)av_malloc(AVIO_BUFFER_SIZE);
+  if(m_buffer && avio_buffer)
+    m_avio = avio_alloc_context(avio_buffer, AVIO_BUFFER_SIZE, 0, this, read_cb, nullptr, nullptr);
+
+  if(!m_avio)
+  {
+    av_free(avio_buffer);
+    free(m_buffer);
+    if(m_close_fd)
+      close(m_fd);
+    throw "PipeBuffer: out of memory";
+  }
+
+  m_avio->seekable = 0;
+
+  CLogLog(LOGDEBUG, "PipeBuffer: %s fd %d, buffer %zu bytes", filename.c_str(), m_fd, m_size);
+
+  pthread_cond_init(&m_cond, nullptr);
+
+  Create(THREAD_DEMUX, "pipebuffer");
+}
+
+PipeBuffer::~PipeBuffer()
+{
+  m_bAbort = true;
+
+  Lock();
+  pthread_cond_broadcast(&m_cond);
+  UnLock();
+
+  StopThread();
+
+  CLogLog(LOGINFO, "PipeBuffer: %llu bytes, %u underruns, %u overruns",
+      (unsigned long long)m_bytes_read, (unsigned int)m_underruns, (unsigned int)m_overruns);
+
+  if(m_close_fd)
+    close(m_fd);
+
+  free(m_buffer);
+  av_free(m_avio->buffer);
+  avio_context_free(&m_avio);
+
+  pthread_cond_destroy(&m_cond);
+}
+
+int PipeBuffer::read_cb(void *opaque, uint8_t *buf, int size)
+{
+  return static_cast<PipeBuffer *>(opaque)->Read(buf, size);
+}
+
+size_t PipeBuffer::GetFill()
+{
+  Lock();
+  size_t fill = m_fill;
+  UnLock();
+  return fill;
+}
+
+void PipeBuffer::Process()
+{
+  bool full = false;
+
+  while(true)
+  {
+    Lock();
+    while(!m_bAbort && m_fill == m_size)
+    {
+      // the writer is being held up by playback
+      if(!full)
+      {
+        full = true;
+        m_overruns++;
+      }
+      pthread_cond_wait(&m_cond, &m_lock);
+    }
+    full = false;
+
+    // only the demuxer moves m_head, and only this thread writes past the
+    // end of what's buffered, so the read itself needs no lock
+    size_t tail = (m_head + m_fill) % m_size;
+    size_t space = std::min({m_size - m_fill, m_size - tail, (size_t)MAX_READ_SIZE});
+    UnLock();
+
+    if(m_bAbort)
+      break;
+
+    // don't block in read() so that a quiet pipe can't hold up StopThread
+    struct pollfd pfd = { m_fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, 100);
+    if(ready == 0 || (ready < 0 && errno == EINTR))
+      continue;
+
+    ssize_t n = read(m_fd, m_buffer + tail, space);
+    if(n < 0 && (errno == EINTR || errno == EAGAIN))
+      continue;
+
+    Lock();
+    if(n > 0)
+    {
+      m_fill += n;
+      m_bytes_read += n;
+    }
+    else
+    {
+      m_eof = true;
+      m_error = n < 0;
+    }
+    pthread_cond_broadcast(&m_cond);
+    UnLock();
+
+    if(n <= 0)
+    {
+      if(n < 0)
+        CLogLog(LOGERROR, "PipeBuffer: read failed: %s", strerror(errno));
+      break;
+    }
+  }
+}
+
+int PipeBuffer::Read(uint8_t *buf, int size)
+{
+  Lock();
+
+  bool waited = false;
+  while(m_fill == 0)
+  {
+    int error = 0;
+    if(m_eof)
+      error = m_error ? AVERROR(EIO) : AVERROR_EOF;
+    else if(m_bAbort || (m_interrupt.callback && m_interrupt.callback(m_interrupt.opaque)))
+      error = AVERROR_EXIT;
+
+    if(error)
+    {
+      UnLock();
+      return error;
+    }
+
+    // the writer has fallen behind playback. Waiting for the first bytes
+    // to arrive doesn't count.
+    if(!waited && m_bytes_out > 0)
+    {
+      m_underruns++;
+      CLogLog(LOGDEBUG, "PipeBuffer: underrun after %llu bytes", (unsigned long long)m_bytes_out);
+    }
+    waited = true;
+
+    // wake up now and then to check the interrupt callback
+    struct timespec endtime;
+    clock_gettime(CLOCK_REALTIME, &endtime);
+    endtime.tv_nsec += 100000000;
+    if(endtime.tv_nsec >= 1000000000)
+    {
+      endtime.tv_sec++;
+      endtime.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&m_cond, &m_lock, &endtime);
+  }
+
+  int n = std::min({(size_t)size, m_fill, m_size - m_head});
+  memcpy(buf, m_buffer + m_head, n);
+  m_head = (m_head + n) % m_size;
+  m_fill -= n;
+  m_bytes_out += n;
+
+  // there's room for the writer again
+  pthread_cond_broadcast(&m_cond);
+  UnLock();
+
+  return n;
+}
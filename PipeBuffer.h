@@ -0,0 +1,78 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <atomic>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+#include "OMXThread.h"
+
+// Reads stdin (pipe:), another inherited descriptor (pipe:N) or a named
+// fifo on its own thread into a fixed size ring buffer which the demuxer
+// reads from. Whoever is writing to the pipe blocks once the buffer is
+// full, so the buffer size bounds how far ahead of playback they can get.
+//
+// The times the demuxer found the buffer empty (underruns) and the writer
+// found it full (overruns) are counted.
+class PipeBuffer : public OMXThread
+{
+public:
+  PipeBuffer(const std::string &filename, const AVIOInterruptCB &interrupt);
+  ~PipeBuffer() override;
+
+  AVIOContext *GetContext() { return m_avio; }
+
+  size_t GetSize() { return m_size; }
+  size_t GetFill();
+  unsigned int GetUnderruns() { return m_underruns; }
+  unsigned int GetOverruns() { return m_overruns; }
+  uint64_t GetBytesRead() { return m_bytes_read; }
+
+  static void SetSize(size_t size) { s_size = size; }
+  static bool Enabled() { return s_size > 0; }
+
+private:
+  void Process() override;
+  int Read(uint8_t *buf, int size);
+
+  static int read_cb(void *opaque, uint8_t *buf, int size);
+
+  AVIOContext               *m_avio = nullptr;
+  AVIOInterruptCB           m_interrupt;
+  pthread_cond_t            m_cond;
+  int                       m_fd = -1;
+  bool                      m_close_fd = false;
+  uint8_t                   *m_buffer = nullptr;
+  size_t                    m_size;
+  size_t                    m_head = 0;   // next byte to hand to the demuxer
+  size_t                    m_fill = 0;
+  bool                      m_eof = false;
+  bool                      m_error = false;
+  std::atomic<unsigned int> m_underruns{0};
+  std::atomic<unsigned int> m_overruns{0};
+  std::atomic<uint64_t>     m_bytes_read{0};
+  uint64_t                  m_bytes_out = 0;
+
+  static size_t             s_size;
+};
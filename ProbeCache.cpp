@@ -0,0 +1,423 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+}
+
+#include "ProbeCache.h"
+#include "utils/misc.h"
+#include "utils/log.h"
+
+// bump this whenever the layout of the records below changes
+#define PROBE_CACHE_VERSION 1
+
+// Even with the streams filled in from the cache the demuxer's own codec
+// contexts only get them through avformat_find_stream_info, and it uses
+// those for things like the B-frame delay when guessing timestamps. So a
+// warm open still probes, just not for long.
+#define WARM_PROBE_SIZE         32768
+#define WARM_ANALYZE_DURATION   100000
+
+// the least recently used files are deleted past either of these
+#define MAX_CACHE_ENTRIES       500
+#define MAX_CACHE_BYTES         (32 * 1024 * 1024)
+
+bool ProbeCache::s_enabled = true;
+
+struct ProbeHeader
+{
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t nb_streams;
+  int64_t  start_time;
+  int64_t  duration;
+  int64_t  bit_rate;
+};
+
+struct StreamRecord
+{
+  int32_t    id;
+  int32_t    codec_type;
+  int32_t    codec_id;
+  uint32_t   codec_tag;
+  int32_t    format;
+  int64_t    bit_rate;
+  int32_t    bits_per_coded_sample;
+  int32_t    bits_per_raw_sample;
+  int32_t    profile;
+  int32_t    level;
+  int32_t    width;
+  int32_t    height;
+  AVRational sample_aspect_ratio;
+  int32_t    sample_rate;
+  int32_t    channels;
+  uint64_t   channel_layout;
+  int32_t    block_align;
+  int32_t    frame_size;
+  int32_t    video_delay;
+  AVRational time_base;
+  AVRational r_frame_rate;
+  AVRational avg_frame_rate;
+  AVRational stream_aspect_ratio;
+  int64_t    start_time;
+  int64_t    duration;
+  int32_t    disposition;
+  uint32_t   extradata_size;
+};
+
+static std::string cache_dir()
+{
+  std::string dir;
+
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if(xdg && *xdg)
+    dir.assign(xdg);
+  else if(home)
+    dir.assign(home).append("/.cache");
+  else
+    return dir;
+
+  mkdir(dir.c_str(), 0755);
+  dir += "/omxplayer";
+  if(mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    dir.clear();
+
+  return dir;
+}
+
+bool ProbeCache::Locate(const std::string &filename, const char *ext, std::string &path, std::string &key)
+{
+  if(!s_enabled || IsURL(filename) || IsPipe(filename))
+    return false;
+
+  char real[PATH_MAX];
+  struct stat st;
+  if(!realpath(filename.c_str(), real) || stat(real, &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+
+  std::string dir = cache_dir();
+  if(dir.empty())
+    return false;
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.", (unsigned long long)std::hash<std::string>{}(real));
+  path = dir + name + ext;
+
+  std::ostringstream k;
+  k << real << '\n' << st.st_size << '\n' << st.st_mtim.tv_sec << '.' << st.st_mtim.tv_nsec << '\n';
+  key = k.str();
+
+  return true;
+}
+
+static bool read_cache(const std::string &path, const std::string &key, std::string &data)
+{
+  std::ifstream f(path, std::ios::binary);
+  if(!f)
+    return false;
+
+  std::ostringstream s;
+  s << f.rdbuf();
+  data = s.str();
+
+  if(data.compare(0, key.size(), key) != 0)
+    return false;
+
+  data.erase(0, key.size());
+
+  // the modification time is what Prune goes by
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  return true;
+}
+
+bool ProbeCache::Load(const std::string &filename, AVFormatContext *fmt)
+{
+  std::string path, key, data;
+  if(!Locate(filename, "probe", path, key) || !read_cache(path, key, data))
+    return false;
+
+  size_t pos = 0;
+  auto get = [&](void *dst, size_t size) {
+    if(pos + size > data.size())
+      return false;
+    memcpy(dst, data.data() + pos, size);
+    pos += size;
+    return true;
+  };
+
+  ProbeHeader h;
+  if(!get(&h, sizeof(h)) || h.version != PROBE_CACHE_VERSION || h.record_size != sizeof(StreamRecord)
+      || h.nb_streams != fmt->nb_streams)
+    return false;
+
+  // check everything before touching the streams
+  std::vector<StreamRecord> records(h.nb_streams);
+  std::vector<size_t> extradata(h.nb_streams);
+  for(unsigned int i = 0; i < h.nb_streams; i++)
+  {
+    StreamRecord &r = records[i];
+    const AVStream *st = fmt->streams[i];
+    if(!get(&r, sizeof(r)) || r.id != st->id || r.codec_type != st->codecpar->codec_type
+        || r.codec_id != st->codecpar->codec_id || pos + r.extradata_size > data.size())
+      return false;
+
+    extradata[i] = pos;
+    pos += r.extradata_size;
+  }
+
+  for(unsigned int i = 0; i < h.nb_streams; i++)
+  {
+    const StreamRecord &r = records[i];
+    AVStream *st = fmt->streams[i];
+    AVCodecParameters *par = st->codecpar;
+
+    par->codec_tag             = r.codec_tag;
+    par->format                = r.format;
+    par->bit_rate              = r.bit_rate;
+    par->bits_per_coded_sample = r.bits_per_coded_sample;
+    par->bits_per_raw_sample   = r.bits_per_raw_sample;
+    par->profile               = r.profile;
+    par->level                 = r.level;
+    par->width                 = r.width;
+    par->height                = r.height;
+    par->sample_aspect_ratio   = r.sample_aspect_ratio;
+    par->sample_rate           = r.sample_rate;
+    par->block_align           = r.block_align;
+    par->frame_size            = r.frame_size;
+    par->video_delay           = r.video_delay;
+
+#if LIBAVCODEC_VERSION_MAJOR < 59
+    par->channels              = r.channels;
+    par->channel_layout        = r.channel_layout;
+#else
+    av_channel_layout_uninit(&par->ch_layout);
+    if(r.channel_layout)
+      av_channel_layout_from_mask(&par->ch_layout, r.channel_layout);
+    else
+      av_channel_layout_default(&par->ch_layout, r.channels);
+#endif
+
+    if(r.extradata_size > 0)
+    {
+      uint8_t *buf = (uint8_t *)av_mallocz(r.extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
+      if(buf)
+      {
+        memcpy(buf, data.data() + extradata[i], r.extradata_size);
+        av_freep(&par->extradata);
+        par->extradata      = buf;
+        par->extradata_size = r.extradata_size;
+      }
+    }
+
+    st->time_base           = r.time_base;
+    st->sample_aspect_ratio = r.stream_aspect_ratio;
+    st->disposition         = r.disposition;
+  }
+
+  int64_t probesize = fmt->probesize;
+  int64_t max_analyze_duration = fmt->max_analyze_duration;
+  fmt->probesize = WARM_PROBE_SIZE;
+  fmt->max_analyze_duration = WARM_ANALYZE_DURATION;
+
+  int result = avformat_find_stream_info(fmt, nullptr);
+
+  fmt->probesize = probesize;
+  fmt->max_analyze_duration = max_analyze_duration;
+
+  if(result < 0)
+    return false;
+
+  // a short probe makes a poor guess at these, so keep what the full one found
+  fmt->start_time = h.start_time;
+  fmt->duration   = h.duration;
+  fmt->bit_rate   = h.bit_rate;
+
+  for(unsigned int i = 0; i < h.nb_streams; i++)
+  {
+    const StreamRecord &r = records[i];
+    AVStream *st = fmt->streams[i];
+
+    st->r_frame_rate        = r.r_frame_rate;
+    st->avg_frame_rate      = r.avg_frame_rate;
+    st->start_time          = r.start_time;
+    st->duration            = r.duration;
+  }
+
+  return true;
+}
+
+void ProbeCache::Save(const std::string &filename, AVFormatContext *fmt)
+{
+  std::string path, key;
+  if(!Locate(filename, "probe", path, key))
+    return;
+
+  std::string data(key);
+  auto put = [&](const void *src, size_t size) {
+    data.append((const char *)src, size);
+  };
+
+  ProbeHeader h = {};
+  h.version     = PROBE_CACHE_VERSION;
+  h.record_size = sizeof(StreamRecord);
+  h.nb_streams  = fmt->nb_streams;
+  h.start_time  = fmt->start_time;
+  h.duration    = fmt->duration;
+  h.bit_rate    = fmt->bit_rate;
+  put(&h, sizeof(h));
+
+  for(unsigned int i = 0; i < fmt->nb_streams; i++)
+  {
+    const AVStream *st = fmt->streams[i];
+    const AVCodecParameters *par = st->codecpar;
+
+    StreamRecord r = {};
+    r.id                    = st->id;
+    r.codec_type            = par->codec_type;
+    r.codec_id              = par->codec_id;
+    r.codec_tag             = par->codec_tag;
+    r.format                = par->format;
+    r.bit_rate              = par->bit_rate;
+    r.bits_per_coded_sample = par->bits_per_coded_sample;
+    r.bits_per_raw_sample   = par->bits_per_raw_sample;
+    r.profile               = par->profile;
+    r.level                 = par->level;
+    r.width                 = par->width;
+    r.height                = par->height;
+    r.sample_aspect_ratio   = par->sample_aspect_ratio;
+    r.sample_rate           = par->sample_rate;
+    r.block_align           = par->block_align;
+    r.frame_size            = par->frame_size;
+    r.video_delay           = par->video_delay;
+
+#if LIBAVCODEC_VERSION_MAJOR < 59
+    r.channels              = par->channels;
+    r.channel_layout        = par->channel_layout;
+#else
+    r.channels              = par->ch_layout.nb_channels;
+    r.channel_layout        = par->ch_layout.order == AV_CHANNEL_ORDER_NATIVE ? par->ch_layout.u.mask : 0;
+#endif
+
+    r.time_base             = st->time_base;
+    r.r_frame_rate          = st->r_frame_rate;
+    r.avg_frame_rate        = st->avg_frame_rate;
+    r.stream_aspect_ratio   = st->sample_aspect_ratio;
+    r.start_time            = st->start_time;
+    r.duration              = st->duration;
+    r.disposition           = st->disposition;
+    r.extradata_size        = par->extradata_size > 0 ? par->extradata_size : 0;
+
+    put(&r, sizeof(r));
+    if(r.extradata_size > 0)
+      put(par->extradata, r.extradata_size);
+  }
+
+  // write to a temporary file so a reader never sees half an entry
+  std::string tmp = path + ".tmp";
+  std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+  if(!f.write(data.data(), data.size()))
+  {
+    CLogLog(LOGWARNING, "ProbeCache: failed to write %s", tmp.c_str());
+    f.close();
+    remove(tmp.c_str());
+    return;
+  }
+  f.close();
+
+  rename(tmp.c_str(), path.c_str());
+
+  Prune();
+}
+
+void ProbeCache::Prune()
+{
+  std::string dir = cache_dir();
+  DIR *d = dir.empty() ? nullptr : opendir(dir.c_str());
+  if(!d)
+    return;
+
+  // a media file's probe and keyframe index share a name and go together
+  struct Entry
+  {
+    time_t    used = 0;
+    off_t     size = 0;
+    std::vector<std::string> files;
+  };
+  std::map<std::string, Entry> entries;
+  off_t total = 0;
+
+  struct dirent *ent;
+  while((ent = readdir(d)) != nullptr)
+  {
+    std::string path = dir + "/" + ent->d_name;
+    struct stat st;
+    if(ent->d_name[0] == '.' || stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+
+    const char *dot = strchr(ent->d_name, '.');
+    Entry &e = entries[std::string(ent->d_name, dot ? dot - ent->d_name : strlen(ent->d_name))];
+    e.used = std::max(e.used, st.st_mtime);
+    e.size += st.st_size;
+    e.files.push_back(path);
+    total += st.st_size;
+  }
+  closedir(d);
+
+  if(entries.size() <= MAX_CACHE_ENTRIES && total <= MAX_CACHE_BYTES)
+    return;
+
+  std::vector<const Entry *> oldest;
+  for(const auto &e : entries)
+    oldest.push_back(&e.second);
+  std::sort(oldest.begin(), oldest.end(),
+      [](const Entry *a, const Entry *b) { return a->used < b->used; });
+
+  size_t count = entries.size();
+  for(const Entry *e : oldest)
+  {
+    if(count <= MAX_CACHE_ENTRIES && total <= MAX_CACHE_BYTES)
+      break;
+
+    for(const std::string &file : e->files)
+      remove(file.c_str());
+
+    count--;
+    total -= e->size;
+  }
+
+  CLogLog(LOGDEBUG, "ProbeCache: pruned %zu entries", entries.size() - count);
+}
@@ -0,0 +1,52 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <string>
+
+struct AVFormatContext;
+
+// Remembers what avformat_find_stream_info found out about a local file so
+// that the next time it's opened only a very short probe is needed. Entries
+// live in ~/.cache/omxplayer, one file per media file, and are only used if
+// the path, size and modification time all still match. The directory is
+// kept to 500 entries and 32MB.
+class ProbeCache
+{
+public:
+  static void SetEnabled(bool enabled) { s_enabled = enabled; }
+
+  // Fills in the streams from the cache and runs the short probe. Returns
+  // false if there's no usable entry, in which case the caller has to do
+  // the full avformat_find_stream_info itself.
+  static bool Load(const std::string &filename, AVFormatContext *fmt);
+  static void Save(const std::string &filename, AVFormatContext *fmt);
+
+  // Works out where the cache file with the given extension for filename
+  // lives and the key which must be stored in it. Returns false for anything
+  // which isn't a local file.
+  static bool Locate(const std::string &filename, const char *ext, std::string &path, std::string &key);
+
+  // Deletes the least recently used entries once the cache has grown past
+  // its limits
+  static void Prune();
+
+private:
+  static bool s_enabled;
+};
@@ -30,6 +30,7 @@ extern "C" {
 
 #include "OMXAlsa.h"
 #include "../utils/log.h"
+#include "../utils/ThreadSched.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 
@@ -726,6 +727,8 @@ static void *gomx_worker(void *ptr)
   OMX_ERRORTYPE r;
 
   CINFO(comp, nullptr, "start");
+  pthread_setname_np(pthread_self(), "alsa-cmd");
+  ThreadSched::Apply(THREAD_ALSA);
   pthread_mutex_lock(&comp->mutex);
   while (comp->state != OMX_StateInvalid) {
     GOMX_COMMAND *cmd = (GOMX_COMMAND *) gomxq_dequeue(&comp->cmdq);
@@ -1021,6 +1024,7 @@ static void *omxalsasink_worker(void *ptr)
   SwrContext *resampler = nullptr;
   uint8_t *resample_buf = nullptr;
   int32_t timescale;
+  int64_t comp_frac = 0;
 
 #if LIBSWRESAMPLE_VERSION_MAJOR < 4
   uint64_t layout;
@@ -1035,6 +1039,8 @@ static void *omxalsasink_worker(void *ptr)
   int err;
 
   CINFO(comp, nullptr, "worker started");
+  pthread_setname_np(pthread_self(), "alsa-out");
+  ThreadSched::Apply(THREAD_ALSA);
 
   err = snd_pcm_open(&dev, sink->device_name, SND_PCM_STREAM_PLAYBACK, 0);
   if (err < 0) goto alsa_error;
@@ -1126,8 +1132,10 @@ static void *omxalsasink_worker(void *ptr)
       omx_init(tst);
       tst.nPortIndex = clock_port->tunnel_port;
       tst.nTimestamp = buf->nTimeStamp;
-      if (resampler && buf->nFlags & OMX_BUFFERFLAG_STARTTIME)
+      if (resampler && buf->nFlags & OMX_BUFFERFLAG_STARTTIME) {
         swr_init(resampler);
+        comp_frac = 0;
+      }
       if (buf->nFlags & (OMX_BUFFERFLAG_STARTTIME|OMX_BUFFERFLAG_DISCONTINUITY)) {
         CINFO(comp, nullptr, "STARTTIME nTimeStamp=%llx", pts);
         sink->starttime = pts;
@@ -1160,8 +1168,15 @@ static void *omxalsasink_worker(void *ptr)
       if (resampler) {
         int delta = 0;
 
-        if (timescale != 0x10000 && timescale >= 0x0100 && timescale <= 0x20000)
-          delta = ((int64_t)in_len*(0x10000-timescale))>>16;
+        /* carry the fraction of a sample over to the next buffer, or the
+         * small speed changes made to hold live latency would be lost */
+        if (timescale != 0x10000 && timescale >= 0x0100 && timescale <= 0x20000) {
+          comp_frac += (int64_t)in_len*(0x10000-timescale);
+          delta = comp_frac >> 16;
+          comp_frac -= (int64_t)delta << 16;
+        } else {
+          comp_frac = 0;
+        }
 
         out_len = resample_bufsz / sink->frame_size;
         swr_set_compensation(resampler, delta, in_len);
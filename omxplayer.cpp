@@ -27,6 +27,7 @@
 #include <filesystem>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include "utils/log.h"
 
@@ -36,6 +37,16 @@
 #include "OMXReader.h"
 #include "OMXReaderFile.h"
 #include "OMXReaderDvd.h"
+#include "ProbeCache.h"
+#include "KeyframeIndex.h"
+#include "NetCache.h"
+#include "BatchProbe.h"
+#include "MmapIO.h"
+#include "PipeBuffer.h"
+#include "LatencyController.h"
+#include "BufferPolicy.h"
+#include "OMXReadAhead.h"
+#include "OMXPrefetch.h"
 #include "OMXPacket.h"
 #include "OMXPlayerVideo.h"
 #include "OMXPlayerAudio.h"
@@ -49,6 +60,9 @@
 #include "RecentFileStore.h"
 #include "RecentDVDStore.h"
 #include "utils/misc.h"
+#include "utils/EventLoop.h"
+#include "utils/ThreadSched.h"
+#include "utils/ThreadStats.h"
 #include "VideoCore.h"
 #include "DbusCommandSearch.h"
 #include "omxplayer.h"
@@ -76,6 +90,11 @@ static std::string       m_external_subtitles_path;
 static bool              m_cmd_line_subtitles  = false;
 static bool              m_Pause               = false;
 static OMXReader         *m_omx_reader         = nullptr;
+static OMXReadAhead      *m_read_ahead         = nullptr;
+static unsigned int      m_read_ahead_size     = 4 * 1024 * 1024;
+static int64_t           m_read_ahead_duration = 10 * AV_TIME_BASE;
+static OMXPrefetch       *m_prefetch           = nullptr;
+static int64_t           m_prefetch_time       = 10 * AV_TIME_BASE; // how long before the end to open the next file
 static int               m_audio_index         = -1;
 static OMXClock          *m_av_clock           = nullptr;
 static OMXControl        m_omxcontrol;
@@ -83,11 +102,17 @@ static Keyboard          *m_keyboard           = nullptr;
 static OMXAudioConfig    m_config_audio;
 static OMXVideoConfig    m_config_video;
 static OMXPacket         *m_omx_pkt            = nullptr;
+static std::vector<OMXPacket *> m_pkt_batch;    // taken from the read ahead queue but not handed on yet
+static size_t            m_pkt_batch_pos       = 0;
+static unsigned int      m_batch_packets       = 8;
+static unsigned int      m_batch_bytes         = 256 * 1024;
+static uint64_t          m_discarded_bytes     = 0;
 static int               m_subtitle_index      = -1;
 static OMXPlayerVideo    *m_player_video       = nullptr;
 static OMXPlayerAudio    *m_player_audio       = nullptr;
 static OMXPlayerSubtitles *m_player_subtitles  = nullptr;
 static bool              m_loop                = false;
+static bool              m_seamless_loop       = false;
 static RecentFileStore   m_file_store;
 static RecentDVDStore    m_dvd_store;
 static AutoPlaylist      m_playlist;
@@ -112,10 +137,13 @@ static std::string       m_audio_lang;
 static std::string       m_subtitle_lang;
 static std::string       m_replacement_filename;
 static bool              m_playlist_enabled    = true;
-static float             m_latency             = 0.0f;
+static LatencyController m_live_latency;
+static BufferPolicy      m_buffer_policy;
+static float             m_live_target         = -1.0f; // latency to aim for, defaults to m_threshold
 static VideoCore         m_video_core;
 static CECListener       *m_cec_listener       = NULL;
 static bool              m_keep_last_frame     = false;
+static bool              m_accurate_seek       = false;
 
 template <class T>
 static void safe_delete(T &object)
@@ -131,6 +159,13 @@ static float playspeeds[] = {0, 1/16.0, 1/8.0, 1/4.0, 1/2.0, 0.975, 1.0, 1.125,
 static const int playspeed_max = 9, playspeed_normal = 6;
 static int playspeed_current = playspeed_normal;
 
+// fast forward and rewind only show keyframes, see trick_hop()
+static const int trick_speed_max = 64;
+static const int64_t trick_interval = 250000; // time between hops in microseconds
+static int trick_speed = 0; // zero when off, negative when rewinding
+static int64_t trick_pts = 0;
+static int64_t trick_hop_time = 0;
+
 enum{ERROR=-1,SUCCESS,ONEBYTE};
 
 // SIGUSR1 is an error in a thread so exit
@@ -209,6 +244,27 @@ static void UpdateRaspicastMetaData(const std::string &msg)
   fp << "local\n" << msg << "\n";
 }
 
+// Where we are in the file. The clock keeps going up through a seamless loop.
+static int64_t get_position()
+{
+  int64_t pts = m_av_clock->GetMediaTime();
+  return m_read_ahead ? m_read_ahead->ToFileTime(pts) : pts;
+}
+
+// Only demux the audio and subtitle streams which are being played. Those
+// which are picked up again are re-read from the current position.
+static void select_streams(bool resync)
+{
+  // trick play only demuxes video; trick_stop applies the choice
+  if(trick_speed != 0)
+    return;
+
+  int audio = m_player_audio ? m_player_audio->GetActiveStream() : -1;
+  int subtitle = m_player_subtitles->GetActiveStream();
+
+  m_read_ahead->SelectStreams(audio, subtitle, resync ? m_av_clock->GetMediaTime() : AV_NOPTS_VALUE);
+}
+
 static void printSubtitleOsd()
 {
   if(m_subtitle_index == -1) {
@@ -226,11 +282,42 @@ static void printSubtitleOsd()
 
 static void SetSpeed(float iSpeed)
 {
-  m_omx_reader->SetSpeed(iSpeed);
+  m_read_ahead->SetSpeed(iSpeed);
   m_av_clock->SetSpeed(iSpeed);
 }
 
-static void FlushStreams(int64_t pts = AV_NOPTS_VALUE)
+// Packets are taken off the read ahead queue several at a time so that its
+// lock is taken once per batch. Unless refill is set this only returns what
+// is left of the current batch.
+static OMXPacket *next_packet(bool refill)
+{
+  if(m_pkt_batch_pos == m_pkt_batch.size())
+  {
+    m_pkt_batch.clear();
+    m_pkt_batch_pos = 0;
+
+    if(!refill || m_read_ahead->Read(m_pkt_batch, m_batch_packets, m_batch_bytes) == 0)
+      return nullptr;
+  }
+
+  return m_pkt_batch[m_pkt_batch_pos++];
+}
+
+static void free_packets()
+{
+  OMXPacket::Free(m_omx_pkt);
+  m_omx_pkt = nullptr;
+
+  while(m_pkt_batch_pos < m_pkt_batch.size())
+    OMXPacket::Free(m_pkt_batch[m_pkt_batch_pos++]);
+
+  m_pkt_batch.clear();
+  m_pkt_batch_pos = 0;
+}
+
+// With exact set play starts at pts rather than at the keyframe the demuxer
+// landed on before it: the frames in between are decoded but not shown.
+static void FlushStreams(int64_t pts = AV_NOPTS_VALUE, bool exact = m_accurate_seek)
 {
   m_av_clock->Stop();
   m_av_clock->Pause();
@@ -246,22 +333,127 @@ static void FlushStreams(int64_t pts = AV_NOPTS_VALUE)
     m_av_clock->SetMediaTime(pts);
     m_av_clock->Pause();
     m_av_clock->Reset(m_player_video, m_player_audio);
+
+    if(exact && m_player_video)
+      m_player_video->SetStartPts(pts);
+    if(exact && m_player_audio)
+      m_player_audio->SetStartPts(pts);
   }
 
   m_player_subtitles->Flush();
+  m_buffer_policy.Flush();
+
+  // drop anything demuxed before the seek
+  if(m_read_ahead)
+    m_read_ahead->Flush();
+
+  free_packets();
+}
+
+// Trick play hops from keyframe to keyframe rather than decoding everything
+// at a higher clock speed. The demuxer drops all but the video keyframes and
+// audio and subtitles aren't read at all. Every trick_interval we seek on by
+// speed times the time since the last hop, which with a keyframe index is a
+// single read, and the clock is let run just long enough to show a frame.
+static bool trick_start(int speed)
+{
+  if(!m_player_video || !m_omx_reader->CanSeek())
+    return false;
 
-  if(m_omx_pkt)
+  if(trick_speed == 0)
   {
-    delete m_omx_pkt;
-    m_omx_pkt = nullptr;
+    trick_pts = get_position();
+    trick_hop_time = 0;
+
+    m_read_ahead->SelectStreams(-1, -1, AV_NOPTS_VALUE);
+    m_player_subtitles->Pause();
+    m_Pause = false;
+  }
+
+  trick_speed = speed;
+  playspeed_current = playspeed_normal;
+  SetSpeed(DVD_PLAYSPEED_NORMAL);
+  m_read_ahead->SetKeyframesOnly(true);
+
+  osd_printf(OSD_NORM | OSD_STDOUT, trick_speed < 0 ? "Rewind: %dx" : "Fast forward: %dx",
+    abs(trick_speed));
+  return true;
+}
+
+// Goes back to normal play. Unless something else is about to seek, play
+// restarts from the last keyframe shown.
+static void trick_stop(bool seek)
+{
+  if(trick_speed == 0)
+    return;
+
+  trick_speed = 0;
+  m_read_ahead->SetKeyframesOnly(false);
+  SetSpeed(playspeeds[playspeed_current]);
+  select_streams(false);
+  m_player_subtitles->Resume();
+
+  int64_t pts = trick_pts;
+  if(seek && m_read_ahead->SeekTime(pts, true) == SEEK_SUCCESS)
+    FlushStreams(pts);
+}
+
+static enum ControlFlow trick_hop(int64_t now)
+{
+  // wait for the decoder to take the last keyframe unless it's stuck
+  int64_t elapsed = trick_hop_time ? now - trick_hop_time : trick_interval;
+  if(elapsed < trick_interval ||
+      (m_player_video->GetCurrentPTS() == AV_NOPTS_VALUE && elapsed < 4 * trick_interval))
+    return CONTINUE;
+
+  int64_t pts = trick_pts + trick_speed * elapsed;
+  int64_t length = m_omx_reader->GetStreamLengthMicro();
+  trick_hop_time = now;
+
+  if(pts <= 0)
+  {
+    // rewound to the start
+    trick_pts = 0;
+    trick_stop(true);
+    return CONTINUE;
+  }
+
+  if(length > 0 && pts >= length)
+  {
+    trick_stop(false);
+    m_send_eos = true;
+    m_next_prev_file = 1;
+    return END_PLAY;
+  }
+
+  // always land on the keyframe before pts so that it is shown straight away
+  trick_pts = pts;
+  switch(m_read_ahead->SeekTime(pts, true))
+  {
+  case SEEK_SUCCESS:
+    FlushStreams(trick_pts, false);
+    show_progress_message(trick_speed < 0 ? "Rewind" : "Fast forward", (int)(trick_pts * 1e-6));
+    break;
+  case SEEK_OUT_OF_BOUNDS:
+    m_send_eos = true;
+    m_next_prev_file = trick_speed < 0 ? -1 : 1;
+    trick_stop(false);
+    return END_PLAY;
+  case SEEK_NO_CHAPTERS:
+  case SEEK_FAIL:
+    trick_stop(true);
+    break;
   }
+  return CONTINUE;
 }
 
 static enum ControlFlow Seek(int seconds_delta)
 {
-  int64_t cur_pts = m_av_clock->GetMediaTime();
+  trick_stop(false);
+
+  int64_t cur_pts = get_position();
 
-  switch(m_omx_reader->SeekTimeDelta(seconds_delta * AV_TIME_BASE, cur_pts))
+  switch(m_read_ahead->SeekTimeDelta(seconds_delta * AV_TIME_BASE, cur_pts))
   {
   case SEEK_SUCCESS:
     show_progress_message("Seek", (int)(cur_pts * 1e-6));
@@ -374,6 +566,24 @@ static int startup(int argc, char *argv[])
   const int omxplayer_log_level = 0x405;
   const int keep_last_frame_opt = 0x8000;
   const int no_cec_opt      = 0x8001;
+  const int read_ahead_opt  = 0x8002;
+  const int audio_queue_time_opt = 0x8003;
+  const int video_queue_time_opt = 0x8004;
+  const int no_probe_cache_opt = 0x8005;
+  const int prefetch_opt    = 0x8006;
+  const int index_scan_opt  = 0x8007;
+  const int net_cache_opt   = 0x8008;
+  const int net_cache_spill_opt = 0x8009;
+  const int probe_json_opt  = 0x800A;
+  const int probe_threads_opt = 0x800B;
+  const int mmap_opt        = 0x800C;
+  const int accurate_seek_opt = 0x800D;
+  const int seamless_loop_opt = 0x800E;
+  const int demux_batch_opt = 0x800F;
+  const int pipe_buffer_opt = 0x8010;
+  const int live_latency_opt = 0x8011;
+  const int live_control_opt = 0x8012;
+  const int thread_sched_opt = 0x8013;
 
   struct option longopts[] = {
     { "info",         no_argument,        nullptr,          'i' },
@@ -416,6 +626,10 @@ static int startup(int argc, char *argv[])
     { "video_fifo",   required_argument,  nullptr,          video_fifo_opt },
     { "audio_queue",  required_argument,  nullptr,          audio_queue_opt },
     { "video_queue",  required_argument,  nullptr,          video_queue_opt },
+    { "audio_queue_time", required_argument, nullptr,       audio_queue_time_opt },
+    { "video_queue_time", required_argument, nullptr,       video_queue_time_opt },
+    { "read_ahead",   required_argument,  nullptr,          read_ahead_opt },
+    { "prefetch",     required_argument,  nullptr,          prefetch_opt },
     { "threshold",    required_argument,  nullptr,          threshold_opt },
     { "timeout",      required_argument,  nullptr,          timeout_opt },
     { "boost-on-downmix", no_argument,    nullptr,          boost_on_downmix_opt },
@@ -443,6 +657,20 @@ static int startup(int argc, char *argv[])
     { "log",          required_argument,  nullptr,          omxplayer_log_level },
     { "keep-last-frame", no_argument,     nullptr,          keep_last_frame_opt },
     { "no-cec",       no_argument,        nullptr,          no_cec_opt },
+    { "no-probe-cache", no_argument,      nullptr,          no_probe_cache_opt },
+    { "index-scan",   no_argument,        nullptr,          index_scan_opt },
+    { "net-cache",    required_argument,  nullptr,          net_cache_opt },
+    { "net-cache-spill", required_argument, nullptr,        net_cache_spill_opt },
+    { "probe-json",   no_argument,        nullptr,          probe_json_opt },
+    { "probe-threads", required_argument, nullptr,          probe_threads_opt },
+    { "mmap",         no_argument,        nullptr,          mmap_opt },
+    { "accurate-seek", no_argument,       nullptr,          accurate_seek_opt },
+    { "seamless-loop", no_argument,       nullptr,          seamless_loop_opt },
+    { "demux-batch",  required_argument,  nullptr,          demux_batch_opt },
+    { "pipe-buffer",  required_argument,  nullptr,          pipe_buffer_opt },
+    { "live-latency", required_argument,  nullptr,          live_latency_opt },
+    { "live-control", required_argument,  nullptr,          live_control_opt },
+    { "thread-sched", required_argument,  nullptr,          thread_sched_opt },
     { nullptr, 0, nullptr, 0 }
   };
 
@@ -456,6 +684,8 @@ static int startup(int argc, char *argv[])
   bool              use_key_ctrl        = true;
   const char        *dbus_name          = "org.mpris.MediaPlayer2.omxplayer";
   bool              enable_cec          = true;
+  bool              probe_json          = false;
+  int               probe_threads       = 0;
 
   while ((c = getopt_long(argc, argv, "awiIhvn:l:o:slb::pd3:Myzt:rg", longopts, nullptr)) != -1)
   {
@@ -755,6 +985,66 @@ static int startup(int argc, char *argv[])
       case video_queue_opt:
         m_config_video.queue_size = atof(optarg) * 1024 * 1024;
         break;
+      case audio_queue_time_opt:
+        if(sscanf(optarg, "%f,%f", &m_config_audio.queue_min_time, &m_config_audio.queue_max_time) != 2)
+        {
+          m_config_audio.queue_min_time = 0.0f;
+          m_config_audio.queue_max_time = atof(optarg);
+        }
+        break;
+      case video_queue_time_opt:
+        if(sscanf(optarg, "%f,%f", &m_config_video.queue_min_time, &m_config_video.queue_max_time) != 2)
+        {
+          m_config_video.queue_min_time = 0.0f;
+          m_config_video.queue_max_time = atof(optarg);
+        }
+        break;
+      case read_ahead_opt:
+        m_read_ahead_size = atof(optarg) * 1024 * 1024;
+        break;
+      case demux_batch_opt:
+        {
+          unsigned int packets = 0, kbytes = 0;
+          int n = sscanf(optarg, "%u,%u", &packets, &kbytes);
+          if(n >= 1)
+            m_batch_packets = std::max(packets, 1u);
+          if(n == 2)
+            m_batch_bytes = std::max(kbytes, 1u) * 1024;
+        }
+        break;
+      case pipe_buffer_opt:
+        PipeBuffer::SetSize(atof(optarg) * 1024 * 1024);
+        break;
+      case net_cache_opt:
+        {
+          float size = 0.0f, readahead = 0.0f;
+          if(sscanf(optarg, "%f,%f", &size, &readahead) != 2)
+          {
+            size = atof(optarg);
+            readahead = size / 4;
+          }
+          NetCache::SetSize(size * 1024 * 1024, readahead * 1024 * 1024);
+        }
+        break;
+      case net_cache_spill_opt:
+        NetCache::SetSpillDir(optarg);
+        break;
+      case probe_json_opt:
+        probe_json = true;
+        break;
+      case probe_threads_opt:
+        probe_threads = atoi(optarg);
+        break;
+      case mmap_opt:
+        MmapIO::SetEnabled(true);
+        break;
+      case accurate_seek_opt:
+        m_accurate_seek = true;
+        OMXReaderFile::SetAccurateSeek(true);
+        break;
+      case prefetch_opt:
+        m_prefetch_time = atof(optarg) * AV_TIME_BASE;
+        break;
       case threshold_opt:
         m_threshold = atof(optarg);
         break;
@@ -770,6 +1060,27 @@ static int startup(int argc, char *argv[])
       case live_opt:
         m_config_audio.is_live = true;
         break;
+      case thread_sched_opt:
+        if(!ThreadSched::Parse(optarg))
+        {
+          printf("Bad argument for --thread-sched: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case live_latency_opt:
+        m_live_target = atof(optarg);
+        break;
+      case live_control_opt:
+        {
+          float kp, ki, max_correction, max_slew;
+          if(sscanf(optarg, "%f,%f,%f,%f", &kp, &ki, &max_correction, &max_slew) != 4)
+          {
+            printf("Bad argument for --live-control: expected kp,ki,max,slew\n");
+            return EXIT_FAILURE;
+          }
+          LatencyController::SetParams(kp, ki, max_correction / 100.0f, max_slew / 100.0f);
+        }
+        break;
       case layout_opt:
         if(optarg[0] >= '2' && optarg[0] <= '7' && optarg[0] != '6' && optarg[1] == '.'
             && (optarg[2] == '0' || optarg[2] == '1'))
@@ -790,6 +1101,9 @@ static int startup(int argc, char *argv[])
       case dbus_name_opt:
         dbus_name = optarg;
         break;
+      case seamless_loop_opt:
+        m_seamless_loop = true;
+        // fall through
       case loop_opt:
         if(m_incr > 0)
             m_loop_from = m_incr;
@@ -836,6 +1150,12 @@ static int startup(int argc, char *argv[])
       case no_cec_opt:
         enable_cec = false;
         break;
+      case no_probe_cache_opt:
+        ProbeCache::SetEnabled(false);
+        break;
+      case index_scan_opt:
+        KeyframeIndex::SetBackgroundScan(true);
+        break;
       case 'h':
         print_usage();
         return EXIT_SUCCESS;
@@ -854,6 +1174,10 @@ static int startup(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
+  // describe the files and exit without touching the display
+  if(probe_json)
+    return BatchProbe::Run(std::vector<std::string>(argv + optind, argv + argc), probe_threads);
+
   if (enable_cec)
     m_cec_listener = new CECListener();
 
@@ -905,7 +1229,10 @@ static int startup(int argc, char *argv[])
 
   osd_print(OSD_EXTRA, "Loading...");
 
-  m_omxcontrol.connect(dbus_name);
+  EventLoop::Init();
+
+  if(m_omxcontrol.connect(dbus_name))
+    EventLoop::Add(m_omxcontrol.getFd());
 
   // 3d modes don't work without switch hdmi mode
   if (m_3d != CONF_FLAGS_FORMAT_NONE || m_NativeDeinterlace)
@@ -940,6 +1267,8 @@ static int startup(int argc, char *argv[])
   if (m_threshold < 0.0f)
     m_threshold = m_config_audio.is_live ? 0.7f : 0.2f;
 
+  m_live_latency.SetTarget(m_live_target > 0.0f ? m_live_target : m_threshold);
+
   // no audio device name has been set on command line
   if(m_config_audio.device.empty())
     m_config_audio.device = m_video_core.getAudioDevice();
@@ -1015,6 +1344,33 @@ restart:
 }
 
 
+// returns the path of a .srt file next to filename, if there is one
+static std::string find_external_subtitles(const std::string &filename)
+{
+  std::string subtitles_path = filename.substr(0, filename.find_last_of(".")) + ".srt";
+
+  if(Exists(subtitles_path))
+    return subtitles_path;
+
+  return "";
+}
+
+// start opening the next playlist item in the background
+static void start_prefetch()
+{
+  std::string next;
+  if(!m_playlist.PeekFile(1, next) || !Exists(next))
+    return;
+
+  // dvd images go through OMXDvdPlayer
+  std::string fileExt = next.substr(next.size()-4, 4);
+  if(fileExt == ".iso" || fileExt == ".dmg")
+    return;
+
+  m_prefetch = new OMXPrefetch(next, !find_external_subtitles(next).empty(),
+    m_read_ahead_size, m_read_ahead_duration);
+}
+
 // we jump here when playing the next item in an auto generated playlist
 static int change_playlist_item()
 {
@@ -1055,12 +1411,7 @@ static int change_playlist_item()
 
     // and check for external subs
     if(!m_cmd_line_subtitles && !IsURL(m_filename))
-    {
-      std::string subtitles_path = m_filename.substr(0, m_filename.find_last_of(".")) + ".srt";
-
-      if(Exists(subtitles_path))
-        m_external_subtitles_path = subtitles_path;
-    }
+      m_external_subtitles_path = find_external_subtitles(m_filename);
   }
 
   // Start from beginning
@@ -1113,6 +1464,23 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
         break;
       }
 
+      // rates the decoders can't keep up with are done by hopping keyframes
+      if(rate < 0.0 || rate > playspeeds[playspeed_max])
+      {
+        int speed = 2;
+        while(speed < trick_speed_max && speed * 1.5 < fabs(rate))
+          speed *= 2;
+        if(rate < 0.0)
+          speed = -speed;
+
+        if(trick_start(speed))
+        {
+          m->respond_double(speed);
+          break;
+        }
+      }
+
+      trick_stop(true);
       int new_speed = get_approx_speed(rate);
       m->respond_double(rate);
 
@@ -1121,6 +1489,11 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
       else
         playspeed_current = new_speed;
     }
+    else if(trick_speed != 0)
+    {
+      // the first change of speed just drops out of fast forward/rewind
+      trick_stop(true);
+    }
     else if(search_key == ACTION_DECREASE_SPEED)
     {
       if(playspeed_current > 1) playspeed_current--;
@@ -1135,10 +1508,24 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
     m_Pause = false;
     break;
 
+  case ACTION_REWIND:
+  case ACTION_FAST_FORWARD:
+    {
+      // each press doubles the speed in the same direction
+      int dir = search_key == ACTION_REWIND ? -1 : 1;
+      int speed = trick_speed * dir > 0 ? std::min(abs(trick_speed) * 2, trick_speed_max) : 2;
+
+      // without video fall back to changing the clock speed
+      if(!trick_start(dir * speed))
+        return handle_event(dir < 0 ? ACTION_DECREASE_SPEED : ACTION_INCREASE_SPEED, m);
+    }
+    break;
+
   case ACTION_STEP:
     {
+      trick_stop(true);
       m_av_clock->Step();
-      int t = m_av_clock->GetMediaTime() * 1e-3;
+      int t = get_position() * 1e-3;
       show_progress_message("Step", t);
     }
     break;
@@ -1172,6 +1559,8 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
       m_audio_index = m_player_audio->SetActiveStreamDelta(delta);
     }
 
+    select_streams(true);
+
     m_audio_lang = m_omx_reader->GetStreamLanguage(OMXSTREAM_AUDIO, m_audio_index);
     if(m_audio_lang.empty())
       osd_printf(OSD_NORM, "Audio stream: %d", m_audio_index + 1);
@@ -1182,11 +1571,12 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
   case ACTION_PREVIOUS_CHAPTER:
   case ACTION_NEXT_CHAPTER:
     {
-      int64_t cur_pts = m_av_clock->GetMediaTime();
+      trick_stop(false);
+      int64_t cur_pts = get_position();
       int delta = search_key == ACTION_NEXT_CHAPTER ? 1 : -1;
       int result_chapter;
 
-      switch(m_omx_reader->SeekChapter(delta, result_chapter, cur_pts))
+      switch(m_read_ahead->SeekChapter(delta, result_chapter, cur_pts))
       {
       case SEEK_SUCCESS:
         osd_printf(OSD_NORM, "Chapter %d", result_chapter + 1);
@@ -1215,11 +1605,13 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
 
   case ACTION_PREVIOUS_SUBTITLE:
     m_subtitle_index = m_player_subtitles->SetActiveStreamDelta(-1);
+    select_streams(true);
     printSubtitleOsd();
     break;
 
   case ACTION_NEXT_SUBTITLE:
     m_subtitle_index = m_player_subtitles->SetActiveStreamDelta(1);
+    select_streams(true);
     printSubtitleOsd();
     break;
 
@@ -1234,22 +1626,26 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
 
       m_subtitle_index = m_player_subtitles->SetActiveStream(index);
       m->respond_bool(m_subtitle_index == index);
+      select_streams(true);
       printSubtitleOsd();
     }
     break;
 
   case ACTION_TOGGLE_SUBTITLE:
     m_subtitle_index = m_player_subtitles->ToggleVisible();
+    select_streams(true);
     printSubtitleOsd();
     break;
 
   case ACTION_HIDE_SUBTITLES:
     m_subtitle_index = m_player_subtitles->SetVisible(false);
+    select_streams(true);
     printSubtitleOsd();
     break;
 
   case ACTION_SHOW_SUBTITLES:
     m_subtitle_index = m_player_subtitles->SetVisible(true);
+    select_streams(true);
     printSubtitleOsd();
     break;
 
@@ -1293,6 +1689,13 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
   case ACTION_PAUSE:
   case ACTION_PLAYPAUSE:
     {
+      // play/pause during fast forward/rewind goes back to normal play
+      if(trick_speed != 0)
+      {
+        trick_stop(true);
+        m_Pause = true;
+      }
+
       m_Pause = search_key == ACTION_PLAYPAUSE ?
         !m_Pause
           :
@@ -1308,7 +1711,7 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
       if(m_Pause) m_player_subtitles->Pause();
       else m_player_subtitles->Resume();
 
-      int t = m_av_clock->GetMediaTime() * 1e-6;
+      int t = get_position() * 1e-6;
       show_progress_message(m_Pause ? "Pause" : "Play", t);
     }
     break;
@@ -1506,7 +1909,7 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
 
   case GET_POSITION:
     // Returns the current position in microseconds
-    m->respond_int64(m_av_clock->GetMediaTime());
+    m->respond_int64(get_position());
     break;
 
   case GET_ASPECT:
@@ -1553,19 +1956,20 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
         break;
       }
 
-      int64_t cur_pts = m_av_clock->GetMediaTime();
+      trick_stop(false);
+      int64_t cur_pts = get_position();
       SeekResult r;
 
       // make absolute value relative
       if(search_key == SET_POSITION)
       {
-        r = m_omx_reader->SeekTime(seek_pts, seek_pts < cur_pts);
+        r = m_read_ahead->SeekTime(seek_pts, seek_pts < cur_pts);
         if(r == SEEK_SUCCESS)
           cur_pts = seek_pts;
       }
       else
       {
-        r = m_omx_reader->SeekTimeDelta(seek_pts, cur_pts);
+        r = m_read_ahead->SeekTimeDelta(seek_pts, cur_pts);
       }
 
       if(r == SEEK_SUCCESS)
@@ -1682,11 +2086,13 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
     }
 
   case LIST_CHAPTERS:
-    {
-      std::vector<std::string> chapter_list;
-      m_omx_reader->GetChapterMetaData(chapter_list);
-      m->respond_array(chapter_list);
-    }
+    m->respond_array(m_omx_reader->GetChapterMetaData());
+    break;
+
+  case GET_CHAPTER:
+    // Returns the chapter being played, or -1 if none
+    m->respond_int64(m_omx_reader->GetChapter(get_position()));
+    break;
 
   case DO_ACTION:
     {
@@ -1705,12 +2111,15 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
     break;
 
   case GET_MAXIMUM_RATE:
-    m->respond_double(playspeeds[playspeed_max]);
+    m->respond_double(m_player_video ? trick_speed_max : playspeeds[playspeed_max]);
     break;
 
   case GET_RATE:
     //return current playing rate
-    m->respond_double((double)m_av_clock->PlaySpeed()/1000.0f);
+    if(trick_speed != 0)
+      m->respond_double(trick_speed);
+    else
+      m->respond_double((double)m_av_clock->PlaySpeed()/1000.0f);
     break;
 
   case GET_VOLUME:
@@ -1718,6 +2127,57 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
     m->respond_double(m_player_audio ? m_player_audio->GetVolume() : 0.0f);
     break;
 
+  case GET_PIPE_BUFFER:
+    {
+      std::vector<std::string> stats;
+      PipeBuffer *pipe = m_omx_reader ? m_omx_reader->GetPipeBuffer() : nullptr;
+      if(pipe)
+      {
+        stats.push_back("size:" + std::to_string(pipe->GetSize()));
+        stats.push_back("fill:" + std::to_string(pipe->GetFill()));
+        stats.push_back("underruns:" + std::to_string(pipe->GetUnderruns()));
+        stats.push_back("overruns:" + std::to_string(pipe->GetOverruns()));
+        stats.push_back("read:" + std::to_string(pipe->GetBytesRead()));
+      }
+      m->respond_array(stats);
+      break;
+    }
+
+  case GET_THREAD_STATS:
+    {
+      // rates since the last time this was asked for
+      static ThreadStats thread_stats;
+      std::vector<ThreadStats::Thread> threads;
+      thread_stats.Sample(threads);
+
+      std::vector<std::string> stats;
+      for(const auto &t : threads)
+      {
+        char buf[64];
+        snprintf(buf, sizeof(buf), ":%.1f:%.0f:%.2f", t.cpu, t.wakeups, t.cpu_time);
+        stats.push_back(std::to_string(t.tid) + ":" + t.name + buf);
+      }
+      m->respond_array(stats);
+      break;
+    }
+
+  case GET_LATENCY:
+    {
+      std::vector<std::string> stats;
+      if(m_config_audio.is_live)
+      {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "latency:%.3f", m_live_latency.GetLatency());
+        stats.push_back(buf);
+        snprintf(buf, sizeof(buf), "target:%.3f", m_live_latency.GetTarget());
+        stats.push_back(buf);
+        snprintf(buf, sizeof(buf), "correction:%.5f", m_live_latency.GetCorrection());
+        stats.push_back(buf);
+      }
+      m->respond_array(stats);
+      break;
+    }
+
   case GET_METADATA:
     {
       std::string url = m_filename;
@@ -1737,14 +2197,28 @@ enum ControlFlow handle_event(enum Action search_key, DMessage *m)
   return CONTINUE;
 }
 
+// Sleep until something wants the main loop's attention or the next status
+// check is due. Returns true if woken by an event.
+static bool wait_for_event(int64_t next_check_time)
+{
+  int64_t timeout = next_check_time - OMXClock::GetAbsoluteClock();
+  return EventLoop::Wait(timeout > 0 ? (timeout + 999) / 1000 : 0);
+}
+
 
 // we jump here when playing the next track in a dvd
 static int run_play_loop()
 {
   try {
+    // use the reader opened while the last file was playing if it's this one
+    if(m_prefetch && !m_DvdPlayer && m_prefetch->Matches(m_filename, !m_external_subtitles_path.empty()))
+      m_omx_reader = m_prefetch->TakeReader();
+    else
+      safe_delete(m_prefetch);
+
     if(m_DvdPlayer)
       m_omx_reader = (OMXReader *)m_DvdPlayer->OpenTrack(m_track);
-    else
+    else if(!m_omx_reader)
       m_omx_reader = (OMXReader *)new OMXReaderFile(m_filename, m_config_audio.is_live,
         !m_external_subtitles_path.empty());
   }
@@ -1755,6 +2229,8 @@ static int run_play_loop()
     return END_PLAY_WITH_ERROR;
   }
 
+  m_buffer_policy.Open(m_filename, m_threshold);
+
   // print chapter info
   if(m_dump_format)
   {
@@ -1779,6 +2255,9 @@ static int run_play_loop()
   // seek at start
   if(m_incr > 0)
   {
+    // anything prefetched is from the wrong place
+    safe_delete(m_prefetch);
+
     int64_t seek_micro = (int64_t)m_incr * AV_TIME_BASE;
     if(m_omx_reader->SeekTime(seek_micro, false) == SEEK_SUCCESS)
       m_incr = seek_micro / AV_TIME_BASE;
@@ -1957,20 +2436,35 @@ static int run_play_loop()
   // forget seek time of all files being played
   if(!m_is_dvd_device) m_file_store.forget(m_filename);
 
-  int64_t last_check_time = 0;
+  // from here on the reader is only touched via the demux thread
+  m_read_ahead = new OMXReadAhead(m_omx_reader, m_read_ahead_size, m_read_ahead_duration,
+    m_prefetch ? &m_prefetch->Packets() : nullptr,
+    m_loop && m_seamless_loop ? (int64_t)m_loop_from * AV_TIME_BASE : AV_NOPTS_VALUE);
+  safe_delete(m_prefetch);
+
+  select_streams(false);
+
+  // only local files in an auto playlist are prefetched
+  bool prefetch_next = m_playlist_enabled && !m_is_dvd_device && !m_DvdPlayer
+    && !m_config_audio.is_live && m_prefetch_time > 0;
+
+  int64_t next_check_time = 0;
+  bool woken = false;
 
   while(!m_stopped)
   {
     int64_t now = OMXClock::GetAbsoluteClock();
     bool update = false;
 
-    if (last_check_time == 0 || last_check_time + 20000 <= now)
+    if (next_check_time <= now)
     {
       update = true;
-      last_check_time = now;
+      // nothing needs watching as closely while paused
+      next_check_time = now + (m_Pause ? 100000 : 20000);
     }
 
-    if (update) {
+    // input is handled as soon as it arrives rather than on the next check
+    if (update || woken) {
       enum Action action;
       enum ControlFlow next;
 
@@ -1987,6 +2481,9 @@ static int run_play_loop()
         return next;
     }
 
+    // more dbus messages may have been read along with the last one
+    woken = m_omxcontrol.pending();
+
     /* player got in an error state */
     if(m_player_audio && m_player_audio->Error())
     {
@@ -1994,6 +2491,13 @@ static int run_play_loop()
       return END_PLAY_WITH_ERROR;
     }
 
+    if (update && trick_speed != 0)
+    {
+      enum ControlFlow next = trick_hop(now);
+      if(next != CONTINUE)
+        return next;
+    }
+
     if (update)
     {
       /* when the video/audio fifos are low, we pause clock, when high we resume */
@@ -2003,6 +2507,10 @@ static int run_play_loop()
 
       float audio_fifo = audio_pts == AV_NOPTS_VALUE ? 0.0f : (audio_pts - stamp) * 1e-6;
       float video_fifo = video_pts == AV_NOPTS_VALUE ? 0.0f : (video_pts - stamp) * 1e-6;
+
+      // packets still queued for the decoders count towards the buffer too
+      float audio_queued = m_player_audio ? m_player_audio->GetCachedDuration() * 1e-6 : 0.0f;
+      float video_queued = m_player_video ? m_player_video->GetCachedDuration() * 1e-6 : 0.0f;
       float threshold = 0.0;
       if(m_player_audio)
         threshold = std::min(0.1f, (float)m_player_audio->GetCacheTotal() * 0.1f);
@@ -2011,36 +2519,86 @@ static int run_play_loop()
 
       bool audio_fifo_low = false, video_fifo_low = false, audio_fifo_high = false, video_fifo_high = false;
 
+      // the media time of the newest data received, for measuring the input rate
+      int64_t buffered_end = AV_NOPTS_VALUE;
+      if(!m_Pause && trick_speed == 0 && !m_read_ahead->IsEof())
+      {
+        float buffered = -1.0f;
+        if(m_player_audio && audio_pts != AV_NOPTS_VALUE)
+          buffered = audio_fifo + audio_queued;
+        if(m_player_video && video_pts != AV_NOPTS_VALUE)
+          buffered = buffered < 0.0f ? video_fifo + video_queued : std::min(buffered, video_fifo + video_queued);
+        if(buffered >= 0.0f)
+          buffered_end = stamp + (int64_t)(buffered * 1e6);
+      }
+      m_buffer_policy.Update(now, buffered_end, !m_av_clock->IsPaused());
+      float buffer_threshold = m_buffer_policy.GetThreshold();
+
+      int64_t length = m_omx_reader->GetStreamLengthMicro();
+      if(prefetch_next && (m_read_ahead->IsEof() || (length > 0 && length - stamp < m_prefetch_time)))
+      {
+        start_prefetch();
+        prefetch_next = false;
+      }
+
       if(m_stats)
       {
+        // which threads are busy, every few seconds
+        static ThreadStats thread_stats;
+        static int64_t thread_report_time;
+        if (now - thread_report_time >= 5000000)
+        {
+          std::vector<ThreadStats::Thread> threads;
+          thread_stats.Sample(threads);
+          if (thread_report_time != 0)
+          {
+            printf("\n");
+            for (const auto &t : threads)
+              printf("  %-15s %6d %5.1f%% %6.0f/s %8.2fs\n", t.name.c_str(), t.tid, t.cpu, t.wakeups, t.cpu_time);
+          }
+          thread_report_time = now;
+        }
+
         static int count;
         if ((count++ & 7) == 0)
         {
           if(m_player_video && m_player_audio)
-            printf("M:%lld V:%6.2fs %6dk/%6dk A:%6.2f %llds/%llds Cv:%6uk Ca:%6uk                            \r", stamp,
+            printf("M:%lld V:%6.2fs %6dk/%6dk A:%6.2f %llds/%llds Cv:%6uk Ca:%6uk P:%u/%u Cp:%lluM Dc:%lluk T:%5.2fs In:%4.2fx U:%u        \r", stamp,
                  video_fifo, (m_player_video->GetDecoderBufferSize()-m_player_video->GetDecoderFreeSpace())>>10, m_player_video->GetDecoderBufferSize()>>10,
                  audio_fifo, m_player_audio->GetDelay(), m_player_audio->GetCacheTotal(),
-                 m_player_video->GetCached()>>10, m_player_audio->GetCached()>>10);
+                 m_player_video->GetCached()>>10, m_player_audio->GetCached()>>10,
+                 OMXPacket::PoolHits(), OMXPacket::PoolMisses(),
+                 (m_player_video->GetCopiedBytes() + m_player_audio->GetCopiedBytes())>>20,
+                 (m_discarded_bytes + m_player_audio->GetDiscardedBytes())>>10,
+                 m_buffer_policy.GetThreshold(), m_buffer_policy.GetInputRate(), m_buffer_policy.GetUnderruns());
           else if(m_player_video)
-            printf("M:%lld V:%6.2fs %6dk/%6dk A:  0.00 0s/0s Cv:%6uk Ca:     0k                            \r", stamp,
+            printf("M:%lld V:%6.2fs %6dk/%6dk A:  0.00 0s/0s Cv:%6uk Ca:     0k P:%u/%u Cp:%lluM Dc:%lluk T:%5.2fs In:%4.2fx U:%u        \r", stamp,
                  video_fifo, (m_player_video->GetDecoderBufferSize()-m_player_video->GetDecoderFreeSpace())>>10, m_player_video->GetDecoderBufferSize()>>10,
-                 m_player_video->GetCached()>>10);
+                 m_player_video->GetCached()>>10,
+                 OMXPacket::PoolHits(), OMXPacket::PoolMisses(),
+                 m_player_video->GetCopiedBytes()>>20,
+                 m_discarded_bytes>>10,
+                 m_buffer_policy.GetThreshold(), m_buffer_policy.GetInputRate(), m_buffer_policy.GetUnderruns());
           else if(m_player_audio)
-            printf("M:%lld V:  0.00s      0k/     0k A:%6.2f %llds/%llds Cv:     0k Ca:%6uk                            \r", stamp,
+            printf("M:%lld V:  0.00s      0k/     0k A:%6.2f %llds/%llds Cv:     0k Ca:%6uk P:%u/%u Cp:%lluM Dc:%lluk T:%5.2fs In:%4.2fx U:%u        \r", stamp,
                  audio_fifo, m_player_audio->GetDelay(), m_player_audio->GetCacheTotal(),
-                 m_player_audio->GetCached()>>10);
+                 m_player_audio->GetCached()>>10,
+                 OMXPacket::PoolHits(), OMXPacket::PoolMisses(),
+                 m_player_audio->GetCopiedBytes()>>20,
+                 (m_discarded_bytes + m_player_audio->GetDiscardedBytes())>>10,
+                 m_buffer_policy.GetThreshold(), m_buffer_policy.GetInputRate(), m_buffer_policy.GetUnderruns());
         }
       }
 
       if (audio_pts != AV_NOPTS_VALUE)
       {
-        audio_fifo_low = m_player_audio && audio_fifo < threshold;
-        audio_fifo_high = !m_player_audio || audio_fifo > m_threshold;
+        audio_fifo_low = m_player_audio && audio_fifo + audio_queued < std::max(threshold, m_config_audio.queue_min_time);
+        audio_fifo_high = !m_player_audio || audio_fifo + audio_queued > m_config_audio.queue_min_time + buffer_threshold;
       }
       if (video_pts != AV_NOPTS_VALUE)
       {
-        video_fifo_low = m_player_video && video_fifo < threshold;
-        video_fifo_high = !m_player_video || video_fifo > m_threshold;
+        video_fifo_low = m_player_video && video_fifo + video_queued < std::max(threshold, m_config_video.queue_min_time);
+        video_fifo_high = !m_player_video || video_fifo + video_queued > m_config_video.queue_min_time + buffer_threshold;
       }
 
       // keep latency under control by adjusting clock (and so resampling audio)
@@ -2057,35 +2615,27 @@ static int run_play_loop()
           {
             if (latency > m_threshold)
             {
-              CLogLog(LOGDEBUG, "Resume %.2f,%.2f (%d,%d,%d,%d) EOF:%d PKT:%p", audio_fifo, video_fifo, audio_fifo_low, video_fifo_low, audio_fifo_high, video_fifo_high, m_omx_reader->IsEof(), m_omx_pkt);
+              CLogLog(LOGDEBUG, "Resume %.2f,%.2f (%d,%d,%d,%d) EOF:%d PKT:%p", audio_fifo, video_fifo, audio_fifo_low, video_fifo_low, audio_fifo_high, video_fifo_high, m_read_ahead->IsEof(), m_omx_pkt);
               m_av_clock->Resume();
-              m_latency = latency;
+              m_live_latency.Reset(latency);
             }
           }
           else
           {
-            m_latency = m_latency*0.99f + latency*0.01f;
-            float speed = 1.0f;
-            if (m_latency < 0.5f*m_threshold)
-              speed = 0.990f;
-            else if (m_latency < 0.9f*m_threshold)
-              speed = 0.999f;
-            else if (m_latency > 2.0f*m_threshold)
-              speed = 1.010f;
-            else if (m_latency > 1.1f*m_threshold)
-              speed = 1.001f;
-
-            m_av_clock->SetSpeed(speed);
-            CLogLog(LOGDEBUG, "Live: %.2f (%.2f) S:%.3f T:%.2f", m_latency, latency, speed, m_threshold);
+            float speed;
+            if (m_live_latency.Update(latency, now, speed))
+              m_av_clock->SetSpeed(speed);
           }
         }
       }
-      else if(!m_Pause && (m_omx_reader->IsEof() || m_omx_pkt || (audio_fifo_high && video_fifo_high)))
+      else if(!m_Pause && (m_read_ahead->IsEof() || m_omx_pkt || (audio_fifo_high && video_fifo_high)
+          || (trick_speed != 0 && video_pts != AV_NOPTS_VALUE)))
       {
         if (m_av_clock->IsPaused())
         {
-          CLogLog(LOGDEBUG, "Resume %.2f,%.2f (%d,%d,%d,%d) EOF:%d PKT:%p", audio_fifo, video_fifo, audio_fifo_low, video_fifo_low, audio_fifo_high, video_fifo_high, m_omx_reader->IsEof(), m_omx_pkt);
+          CLogLog(LOGDEBUG, "Resume %.2f,%.2f (%d,%d,%d,%d) EOF:%d PKT:%p", audio_fifo, video_fifo, audio_fifo_low, video_fifo_low, audio_fifo_high, video_fifo_high, m_read_ahead->IsEof(), m_omx_pkt);
           m_av_clock->Resume();
+          m_buffer_policy.Resumed(now);
         }
       }
       else if (m_Pause || audio_fifo_low || video_fifo_low)
@@ -2093,24 +2643,24 @@ static int run_play_loop()
         if (!m_av_clock->IsPaused())
         {
           if (!m_Pause)
-            m_threshold = std::min(2.0f*m_threshold, 16.0f);
-          CLogLog(LOGDEBUG, "Pause %.2f,%.2f (%d,%d,%d,%d) %.2f", audio_fifo, video_fifo, audio_fifo_low, video_fifo_low, audio_fifo_high, video_fifo_high, m_threshold);
+            m_buffer_policy.Underrun(now);
+          CLogLog(LOGDEBUG, "Pause %.2f,%.2f (%d,%d,%d,%d) %.2f", audio_fifo, video_fifo, audio_fifo_low, video_fifo_low, audio_fifo_high, video_fifo_high, m_buffer_policy.GetThreshold());
           m_av_clock->Pause();
         }
       }
     }
 
     if(!m_omx_pkt)
-      m_omx_pkt = m_omx_reader->Read();
+      m_omx_pkt = next_packet(true);
 
     if(m_omx_pkt)
       m_send_eos = false;
 
-    if(m_omx_reader->IsEof() && !m_omx_pkt)
+    if(m_read_ahead->IsEof() && !m_omx_pkt)
     {
       if (!m_loop && m_keep_last_frame)
       {
-        OMXClock::Sleep(100);
+        woken = EventLoop::Wait(100) || woken;
         continue;
       }
 
@@ -2122,14 +2672,14 @@ static int run_play_loop()
       if ( (m_player_video && !m_player_video->IsEOS()) ||
            (m_player_audio && !m_player_audio->IsEOS()) )
       {
-        OMXClock::Sleep(10);
+        woken = wait_for_event(next_check_time) || woken;
         continue;
       }
 
       if (m_loop)
       {
         int64_t seek_ts = (int64_t)m_loop_from * AV_TIME_BASE;
-        if(m_omx_reader->SeekTime(seek_ts, true) == SEEK_SUCCESS)
+        if(m_read_ahead->SeekTime(seek_ts, true) == SEEK_SUCCESS)
         {
           FlushStreams(seek_ts);
           continue;
@@ -2139,49 +2689,66 @@ static int run_play_loop()
       break;
     }
 
+    // the demux thread wakes us when it queues something
     if(!m_omx_pkt)
     {
-      OMXClock::Sleep(10);
+      woken = wait_for_event(next_check_time) || woken;
       continue;
     }
 
-    if(m_omx_pkt->stream_type_index == -1)
-      goto discard_packet;
-
-    switch(m_omx_pkt->codec_type)
+    // hand on the rest of the batch without going back round the loop,
+    // unless one of the players is full
+    while(m_omx_pkt)
     {
-    case AVMEDIA_TYPE_VIDEO:
-      if(!m_player_video || m_omx_pkt->stream_type_index != 0)
+      bool full = false;
+
+      if(m_omx_pkt->stream_type_index == -1)
         goto discard_packet;
 
-      if(m_player_video->AddPacket(m_omx_pkt))
-        m_omx_pkt = nullptr;
-      else
-        OMXClock::Sleep(10);
-      break;
+      switch(m_omx_pkt->codec_type)
+      {
+      case AVMEDIA_TYPE_VIDEO:
+        if(!m_player_video || m_omx_pkt->stream_type_index != 0)
+          goto discard_packet;
 
-    case AVMEDIA_TYPE_AUDIO:
-      if(!m_player_audio || playspeed_current != playspeed_normal)
-        goto discard_packet;
+        if(m_player_video->AddPacket(m_omx_pkt))
+          m_omx_pkt = nullptr;
+        else
+          full = true;
+        break;
+
+      case AVMEDIA_TYPE_AUDIO:
+        if(!m_player_audio || playspeed_current != playspeed_normal)
+          goto discard_packet;
 
-      if(m_player_audio->AddPacket(m_omx_pkt))
+        if(m_player_audio->AddPacket(m_omx_pkt))
+          m_omx_pkt = nullptr;
+        else
+          full = true;
+        break;
+
+      case AVMEDIA_TYPE_SUBTITLE:
+        if(m_audio_index == -2 || playspeed_current != playspeed_normal)
+          goto discard_packet;
+
+        m_player_subtitles->AddPacket(m_omx_pkt);
         m_omx_pkt = nullptr;
-      else
-        OMXClock::Sleep(10);
-      break;
+        break;
 
-    case AVMEDIA_TYPE_SUBTITLE:
-      if(m_audio_index == -2 || playspeed_current != playspeed_normal)
-        goto discard_packet;
+      discard_packet:
+      default:
+        m_discarded_bytes += m_omx_pkt->avpkt->size;
+        OMXPacket::Free(m_omx_pkt);
+        m_omx_pkt = nullptr;
+      }
 
-      m_player_subtitles->AddPacket(m_omx_pkt);
-      m_omx_pkt = nullptr;
-      break;
+      if(full)
+      {
+        woken = wait_for_event(next_check_time) || woken;
+        break;
+      }
 
-    discard_packet:
-    default:
-      delete m_omx_pkt;
-      m_omx_pkt = nullptr;
+      m_omx_pkt = next_packet(false);
     }
   }
   return END_PLAY;
@@ -2196,7 +2763,7 @@ static void end_of_play_loop()
   m_player_subtitles->Close();
   m_cmd_line_subtitles = false;
 
-  int t = (int)(m_av_clock->GetMediaTime()*1e-6);
+  int t = (int)(get_position()*1e-6);
   int dur = m_omx_reader ? m_omx_reader->GetStreamLengthSeconds() : 0;
   printf("Stopped at: %02d:%02d:%02d\n", (t/3600), (t/60)%60, t%60);
   printf("  Duration: %02d:%02d:%02d\n", (dur/3600), (dur/60)%60, dur%60);
@@ -2217,8 +2784,16 @@ static void end_of_play_loop()
   // flush streams
   FlushStreams();
 
+  // the next file starts at normal speed
+  if(trick_speed != 0)
+  {
+    trick_speed = 0;
+    m_player_subtitles->Resume();
+  }
+
   safe_delete(m_player_video);
   safe_delete(m_player_audio);
+  safe_delete(m_read_ahead);
   safe_delete(m_omx_reader);
 
   // stop seeking
@@ -2297,10 +2872,12 @@ static int shutdown(bool exit_with_error)
 {
   // We may get here after receiving an error
   // so be conservative and check before deleting objects
-  safe_delete(m_omx_pkt);
+  free_packets();
   safe_delete(m_player_video);
   safe_delete(m_player_audio);
   safe_delete(m_DvdPlayer);
+  safe_delete(m_prefetch);
+  OMXPacket::ClearPool();
 
   // Exit on failure
   if(exit_with_error)
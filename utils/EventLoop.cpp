@@ -0,0 +1,87 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "EventLoop.h"
+
+#define MAX_EVENTS 8
+
+int EventLoop::s_epoll_fd = -1;
+int EventLoop::s_wake_fd = -1;
+
+void EventLoop::Init()
+{
+  s_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if(s_epoll_fd == -1)
+    throw "Failed to create epoll instance";
+
+  s_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(s_wake_fd == -1 || !Add(s_wake_fd))
+    throw "Failed to create eventfd";
+}
+
+bool EventLoop::Add(int fd)
+{
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+
+  return epoll_ctl(s_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+void EventLoop::Remove(int fd)
+{
+  epoll_ctl(s_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+// Safe to call from any thread, or from a callback
+void EventLoop::Wake()
+{
+  if(s_wake_fd == -1)
+    return;
+
+  uint64_t one = 1;
+  while(write(s_wake_fd, &one, sizeof(one)) == -1 && errno == EINTR);
+}
+
+// Returns true if something happened, false if the timeout expired
+bool EventLoop::Wait(int timeout_ms)
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  int n = epoll_wait(s_epoll_fd, events, MAX_EVENTS, timeout_ms);
+  if(n <= 0)
+    return n == -1 && errno == EINTR;
+
+  for(int i = 0; i < n; i++)
+  {
+    if(events[i].data.fd == s_wake_fd)
+    {
+      uint64_t count;
+      while(read(s_wake_fd, &count, sizeof(count)) == -1 && errno == EINTR);
+    }
+  }
+
+  return true;
+}
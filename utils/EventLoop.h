@@ -0,0 +1,36 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+// Lets the main loop sleep until there is something for it to do. File
+// descriptors (eg the dbus socket) can be watched directly; everything else
+// (keyboard and cec threads, the demux thread, the players) calls Wake().
+class EventLoop
+{
+public:
+  static void Init();
+  static bool Add(int fd);
+  static void Remove(int fd);
+  static void Wake();
+  static bool Wait(int timeout_ms);
+
+private:
+  static int s_epoll_fd;
+  static int s_wake_fd;
+};
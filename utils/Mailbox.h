@@ -90,7 +90,7 @@ public:
 
     ~Push() override
     {
-      delete pkt;
+      OMXPacket::Free(pkt);
     }
 
     OMXPacket *pkt;
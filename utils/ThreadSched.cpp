@@ -0,0 +1,216 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <string>
+
+#include "ThreadSched.h"
+#include "log.h"
+
+// nice level used when realtime scheduling isn't permitted
+#define REALTIME_FALLBACK_NICE -10
+
+static const char *role_names[THREAD_ROLE_END] = {
+  "default", "audio", "video", "subtitle", "input", "demux", "background", "alsa",
+};
+
+// The alsa sink has to keep the sound card fed whatever else is running.
+// Keyframe scans and batch probes can wait.
+ThreadSched::Settings ThreadSched::s_settings[THREAD_ROLE_END] = {
+  { SCHED_OTHER, 0, 0,                      0 }, // default
+  { SCHED_OTHER, 0, 0,                      0 }, // audio
+  { SCHED_OTHER, 0, 0,                      0 }, // video
+  { SCHED_OTHER, 0, 0,                      0 }, // subtitle
+  { SCHED_OTHER, 0, 0,                      0 }, // input
+  { SCHED_OTHER, 0, 0,                      0 }, // demux
+  { SCHED_OTHER, 0, 10,                     0 }, // background
+  { SCHED_FIFO,  10, REALTIME_FALLBACK_NICE, 0 }, // alsa
+};
+
+static bool s_configured[THREAD_ROLE_END];
+
+// cpus are listed as n or n-m, joined by +
+static bool parse_cpus(const std::string &str, uint32_t &cpus)
+{
+  cpus = 0;
+  size_t start = 0;
+  while(start < str.size())
+  {
+    size_t end = str.find('+', start);
+    if(end == std::string::npos)
+      end = str.size();
+
+    int first, last, n;
+    std::string range = str.substr(start, end - start);
+    if(sscanf(range.c_str(), "%d-%d%n", &first, &last, &n) == 2 && n == (int)range.size())
+      ;
+    else if(sscanf(range.c_str(), "%d%n", &first, &n) == 1 && n == (int)range.size())
+      last = first;
+    else
+      return false;
+
+    if(first < 0 || last > 31 || first > last)
+      return false;
+
+    for(int i = first; i <= last; i++)
+      cpus |= 1u << i;
+
+    start = end + 1;
+  }
+  return cpus != 0;
+}
+
+static bool parse_level(const std::string &str, const char *name, int min, int max, int &level)
+{
+  size_t len = strlen(name);
+  if(str.compare(0, len, name) != 0 || str.size() <= len || str[len] != ':')
+    return false;
+
+  char *end;
+  long l = strtol(str.c_str() + len + 1, &end, 10);
+  if(*end != '\0' || l < min || l > max)
+    return false;
+
+  level = l;
+  return true;
+}
+
+bool ThreadSched::Parse(const char *spec)
+{
+  std::string str(spec);
+  size_t start = 0;
+
+  while(start < str.size())
+  {
+    size_t end = str.find(',', start);
+    if(end == std::string::npos)
+      end = str.size();
+
+    std::string item = str.substr(start, end - start);
+    start = end + 1;
+
+    size_t eq = item.find('=');
+    if(eq == std::string::npos)
+      return false;
+
+    int role = 0;
+    while(role < THREAD_ROLE_END && item.compare(0, eq, role_names[role]) != 0)
+      role++;
+    if(role == THREAD_ROLE_END)
+      return false;
+
+    Settings s = s_settings[role];
+    std::string setting = item.substr(eq + 1);
+
+    size_t at = setting.find('@');
+    if(at != std::string::npos)
+    {
+      if(!parse_cpus(setting.substr(at + 1), s.cpus))
+        return false;
+      setting.erase(at);
+    }
+
+    int level;
+    if(setting.empty())
+      ; // just the cpus
+    else if(setting == "other")
+      s.policy = SCHED_OTHER, s.nice = 0;
+    else if(parse_level(setting, "nice", -20, 19, level))
+      s.policy = SCHED_OTHER, s.nice = level;
+    else if(parse_level(setting, "fifo", sched_get_priority_min(SCHED_FIFO), sched_get_priority_max(SCHED_FIFO), level))
+      s.policy = SCHED_FIFO, s.priority = level, s.nice = REALTIME_FALLBACK_NICE;
+    else if(parse_level(setting, "rr", sched_get_priority_min(SCHED_RR), sched_get_priority_max(SCHED_RR), level))
+      s.policy = SCHED_RR, s.priority = level, s.nice = REALTIME_FALLBACK_NICE;
+    else
+      return false;
+
+    s_settings[role] = s;
+    s_configured[role] = true;
+  }
+
+  return true;
+}
+
+void ThreadSched::Apply(ThreadRole role)
+{
+  const Settings &s = s_settings[role];
+  const char *name = role_names[role];
+
+  // only complain about what was asked for on the command line
+  int level = s_configured[role] ? LOGWARNING : LOGDEBUG;
+
+  bool realtime = false;
+  if(s.policy != SCHED_OTHER)
+  {
+    struct sched_param param = {};
+    param.sched_priority = s.priority;
+
+    int err = pthread_setschedparam(pthread_self(), s.policy, &param);
+    if(err == 0)
+    {
+      realtime = true;
+      CLogLog(LOGDEBUG, "ThreadSched: %s thread %s priority %d", name,
+          s.policy == SCHED_FIFO ? "fifo" : "rr", s.priority);
+    }
+    else
+    {
+      CLogLog(level, "ThreadSched: %s thread can't have realtime priority: %s", name, strerror(err));
+    }
+  }
+
+  // setpriority on a thread id only affects that thread
+  if(!realtime && s.nice != 0)
+  {
+    if(setpriority(PRIO_PROCESS, syscall(SYS_gettid), s.nice) == 0)
+    {
+      CLogLog(LOGDEBUG, "ThreadSched: %s thread nice %d", name, s.nice);
+    }
+    else
+    {
+      CLogLog(level, "ThreadSched: %s thread can't have nice %d: %s", name, s.nice, strerror(errno));
+    }
+  }
+
+  if(s.cpus)
+  {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int i = 0; i < 32; i++)
+      if(s.cpus & (1u << i))
+        CPU_SET(i, &set);
+
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(err == 0)
+    {
+      CLogLog(LOGDEBUG, "ThreadSched: %s thread cpus %#x", name, s.cpus);
+    }
+    else
+    {
+      CLogLog(LOGWARNING, "ThreadSched: %s thread can't be tied to cpus %#x: %s", name, s.cpus, strerror(err));
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+
+enum ThreadRole
+{
+  THREAD_DEFAULT,
+  THREAD_AUDIO,       // audio decoder
+  THREAD_VIDEO,       // video decoder
+  THREAD_SUBTITLE,
+  THREAD_INPUT,       // keyboard
+  THREAD_DEMUX,       // read ahead, prefetch, pipe buffer and network cache
+  THREAD_BACKGROUND,  // keyframe scans and batch probes
+  THREAD_ALSA,        // alsa sink
+  THREAD_ROLE_END
+};
+
+// Scheduling policy, priority, nice level and cpu affinity for each kind of
+// thread. A thread applies its own settings when it starts. Where realtime
+// scheduling isn't permitted the nice level is used instead, and where that
+// isn't permitted either the thread carries on as it is.
+class ThreadSched
+{
+public:
+  // a comma separated list of role=setting[@cpus], see omxplayer.pod
+  static bool Parse(const char *spec);
+  static void Apply(ThreadRole role);
+
+private:
+  struct Settings
+  {
+    int       policy;
+    int       priority;   // for SCHED_FIFO and SCHED_RR
+    int       nice;       // for SCHED_OTHER, or if realtime isn't permitted
+    uint32_t  cpus;       // bit per cpu, 0 for any
+  };
+
+  static Settings s_settings[THREAD_ROLE_END];
+};
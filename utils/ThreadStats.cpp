@@ -0,0 +1,131 @@
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+
+#include "ThreadStats.h"
+
+static int64_t monotonic_us()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// utime and stime from /proc/self/task/<tid>/stat, in clock ticks
+static bool read_ticks(const std::string &dir, uint64_t &ticks)
+{
+  std::ifstream file(dir + "/stat");
+  std::string line;
+  if(!std::getline(file, line))
+    return false;
+
+  // the name in brackets may have spaces and brackets in it
+  size_t pos = line.rfind(')');
+  if(pos == std::string::npos)
+    return false;
+
+  // fields from the state (3rd) on, utime and stime being the 14th and 15th
+  unsigned long long utime, stime;
+  if(sscanf(line.c_str() + pos + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+      &utime, &stime) != 2)
+    return false;
+
+  ticks = utime + stime;
+  return true;
+}
+
+// a thread which sleeps and is woken up again makes a voluntary context switch
+static uint64_t read_switches(const std::string &dir)
+{
+  std::ifstream file(dir + "/status");
+  std::string line;
+  while(std::getline(file, line))
+  {
+    if(line.compare(0, 24, "voluntary_ctxt_switches:") == 0)
+      return strtoull(line.c_str() + 24, nullptr, 10);
+  }
+  return 0;
+}
+
+void ThreadStats::Sample(std::vector<Thread> &threads)
+{
+  threads.clear();
+
+  static const long ticks_per_sec = sysconf(_SC_CLK_TCK);
+  int64_t now = monotonic_us();
+  float elapsed = m_last_time ? (now - m_last_time) * 1e-6f : 0.0f;
+  m_last_time = now;
+
+  DIR *tasks = opendir("/proc/self/task");
+  if(!tasks)
+    return;
+
+  std::unordered_map<int, Last> last;
+
+  struct dirent *ent;
+  while((ent = readdir(tasks)) != nullptr)
+  {
+    int tid = atoi(ent->d_name);
+    if(tid <= 0)
+      continue;
+
+    std::string dir = std::string("/proc/self/task/") + ent->d_name;
+
+    Thread t;
+    t.tid = tid;
+
+    // the thread may have exited since the directory was read
+    Last cur;
+    if(!read_ticks(dir, cur.ticks))
+      continue;
+    cur.switches = read_switches(dir);
+
+    std::ifstream comm(dir + "/comm");
+    std::getline(comm, t.name);
+
+    t.cpu_time = (double)cur.ticks / ticks_per_sec;
+    t.cpu = 0.0f;
+    t.wakeups = 0.0f;
+
+    auto it = m_last.find(tid);
+    if(it != m_last.end() && elapsed > 0.0f)
+    {
+      t.cpu = (cur.ticks - it->second.ticks) * 100.0f / ticks_per_sec / elapsed;
+      t.wakeups = (cur.switches - it->second.switches) / elapsed;
+    }
+
+    last[tid] = cur;
+    threads.push_back(t);
+  }
+  closedir(tasks);
+
+  // threads which have gone are forgotten
+  m_last.swap(last);
+
+  std::sort(threads.begin(), threads.end(),
+      [](const Thread &a, const Thread &b) { return a.tid < b.tid; });
+}
@@ -0,0 +1,52 @@
+#pragma once
+/*
+ *
+ *      Copyright (C) 2022 Michael Walsh
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+// Cpu time and wakeups of each of our threads, read from /proc/self/task.
+// Rates are worked out since the last call to Sample on the same object,
+// so each consumer of them should have its own.
+class ThreadStats
+{
+public:
+  struct Thread
+  {
+    int         tid;
+    std::string name;
+    float       cpu;        // percent of one cpu
+    float       wakeups;    // per second
+    double      cpu_time;   // seconds in total
+  };
+
+  void Sample(std::vector<Thread> &threads);
+
+private:
+  struct Last
+  {
+    uint64_t    ticks;
+    uint64_t    switches;
+  };
+
+  std::unordered_map<int, Last> m_last;
+  int64_t     m_last_time = 0;
+};
@@ -17,6 +17,8 @@
  * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
  */
 
+#include <stdio.h>
+#include <sys/stat.h>
 #include <string>
 
 #include "misc.h"
@@ -92,11 +94,43 @@ bool Exists(const std::string& path)
 
 bool IsURL(const std::string &str)
 {
-  static CRegExp protocol_match("^[a-zA-Z]+://");
+  // CRegExp keeps its match state, so each thread needs its own
+  static thread_local CRegExp protocol_match("^[a-zA-Z]+://");
   return protocol_match.RegFind(str) > -1;
 }
 
 bool IsPipe(const std::string& str)
 {
-  return str.substr(0, 5) == "pipe:";
+  if(str.substr(0, 5) == "pipe:")
+    return true;
+
+  // a named fifo can't be seeked or probed any more than stdin can
+  struct stat st;
+  return stat(str.c_str(), &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+std::string json_escape(const std::string &str)
+{
+  std::string out;
+  out.reserve(str.size());
+
+  for(unsigned char c : str) {
+    switch(c) {
+    case '"':  out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\n': out += "\\n"; break;
+    case '\r': out += "\\r"; break;
+    case '\t': out += "\\t"; break;
+    default:
+      if(c < 0x20) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\u%04x", c);
+        out += buf;
+      } else {
+        out += c;
+      }
+    }
+  }
+
+  return out;
 }
@@ -24,3 +24,4 @@ void uri_unescape(std::string &s);
 bool Exists(const std::string& path);
 bool IsURL(const std::string &str);
 bool IsPipe(const std::string& str);
+std::string json_escape(const std::string &str);